@@ -0,0 +1,20 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+
+out vec2 TexCoord;
+out float AO;
+uniform mat4 transform;
+uniform mat4 model;
+layout (std140) uniform Frame {
+	mat4 view;
+	mat4 projection;
+	float time;
+};
+
+void main() {
+	gl_Position = projection * view * model * vec4(aPos, 1.0);
+	TexCoord = aTexCoord;
+	AO = 1.0;
+}
\ No newline at end of file
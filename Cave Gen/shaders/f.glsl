@@ -2,6 +2,7 @@
 
 out vec4 FragColor;
 in vec2 TexCoord;
+in float AO;
 
 uniform sampler2D texture1;
 uniform sampler2D texture2;
@@ -9,4 +10,5 @@ uniform float mixVal;
 
 void main() {
 	FragColor = mix(texture(texture1, TexCoord), texture(texture2, TexCoord), mixVal);
+	FragColor.rgb *= AO;
 }
\ No newline at end of file
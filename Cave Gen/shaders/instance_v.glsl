@@ -0,0 +1,19 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in vec3 aOffset;
+
+out vec2 TexCoord;
+out float AO;
+layout (std140) uniform Frame {
+	mat4 view;
+	mat4 projection;
+	float time;
+};
+
+void main() {
+	gl_Position = projection * view * vec4(aPos + aOffset, 1.0);
+	TexCoord = aTexCoord;
+	AO = 1.0;
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#version 330 core
+
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec3 aColour;
+
+out vec3 Colour;
+
+// window size in pixels in xy
+uniform vec3 screen;
+
+void main() {
+	gl_Position = vec4(aPos / screen.xy * 2.0 - 1.0, 0.0, 1.0);
+	Colour = aColour;
+}
\ No newline at end of file
@@ -1,15 +1,32 @@
 #version 330 core
 
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec2 aTexCoord;
+layout (location = 0) in uint aPacked;
 
 out vec2 TexCoord;
-uniform mat4 transform;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+out float AO;
+layout (std140) uniform Frame {
+	mat4 view;
+	mat4 projection;
+	float time;
+};
+uniform vec3 chunkOrigin;
+
+const float aoCurve[4] = float[4](0.35, 0.55, 0.8, 1.0);
 
 void main() {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
-	TexCoord = aTexCoord;
+	// see packVertex() in src/mesher.h
+	vec3 pos = vec3(aPacked & 63u, (aPacked >> 6) & 63u, (aPacked >> 12) & 63u);
+	uint axis = ((aPacked >> 18) & 7u) / 2u;
+	AO = aoCurve[(aPacked >> 21) & 3u];
+
+	if (axis == 0u) {
+		TexCoord = pos.zy;
+	}
+	else if (axis == 1u) {
+		TexCoord = pos.zx;
+	}
+	else {
+		TexCoord = pos.xy;
+	}
+	gl_Position = projection * view * vec4(chunkOrigin + pos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,124 @@
+/*
+	Steady-state allocation check
+	---------------------
+	g++ -O2 -std=c++17 -Iinclude src/alloc_check.cpp src/glad.c -lpthread -o cave_alloc_check
+	./cave_alloc_check [--frames N] [--size N]
+	Runs the CPU side of the frame loop on a carved test cave, through
+	the same frame_loop.h functions main.cpp calls. The simulation thread
+	culls (frustum, PVS, occlusion) into render lists and publishes them.
+	A render thread acquires them, runs the pending jobs and mesh changes,
+	and keeps the frame profiler and its summary up to date. Only the GL
+	calls between those steps are left out. The camera visits a new
+	spot in the caves every frame. After ALLOC_WARMUP_FRAMES frames
+	neither thread may allocate; the check exits non-zero if either did.
+	---------------------
+*/
+#define ALLOC_TRACKER_IMPLEMENTATION
+#include "alloc_tracker.h"
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include <glm/gtc/matrix_transform.hpp>
+#include "lsystem.h"
+#include "chunk.h"
+#include "mesher.h"
+#include "jobs.h"
+#include "frustum.h"
+#include "pvs.h"
+#include "occlusion.h"
+#include "profiler.h"
+#include "render_queue.h"
+#include "memory.h"
+#include "frame_loop.h"
+#include "test_cave.h"
+
+JobSystem* jobs = NULL;
+RenderQueue renderQueue;
+// render thread only, read once it has been joined
+AllocFrames renderFrames;
+
+void renderLoop() {
+    // main.cpp's renderLoop() with the GL calls left out
+    FrameProfiler profiler(false);
+    // never flushed, so nothing is ever placed and every draw is skipped
+    UploadScheduler uploads;
+    while (renderQueue.isRunning()) {
+        RenderList* list;
+        bool fresh;
+        if (!acquireFrame(renderQueue, &list, &fresh)) {
+            continue;
+        }
+        beginRenderFrame(*list, fresh, profiler, renderFrames);
+        runRenderWork(jobs, *list, uploads);
+        int drawn = 0;
+        for (auto& draw : list->draws) {
+            drawn += (uploads.find(draw.chunk) != NULL) ? 1 : 0;
+        }
+        countRenderFrame(profiler, *list, fresh, drawn, drawn);
+        profiler.summary();
+        endRenderFrame(profiler, renderFrames);
+        std::this_thread::yield();
+    }
+}
+
+int main(int argc, char** argv) {
+    int checkFrames = (int)intOption(argc, argv, "--frames", 600);
+    int size = (int)intOption(argc, argv, "--size", 128);
+    MemoryTracker::get().quiet = true;
+    jobs = new JobSystem();
+
+    LSystem lsystem("alloc check");
+    lsystem.verbose = false;
+    lsystem.numCubes = size;
+    lsystem.setupMatrix();
+    carveTestCave(lsystem);
+    VoxelGrid* grid = new VoxelGrid(lsystem.matrix, size, jobs);
+    std::vector<packedVertex> vertices;
+    Mesher mesher;
+    for (auto chunk : grid->chunks) {
+        mesher.mesh(grid, chunk, vertices);
+        chunk->vertexCount = (int)vertices.size();
+    }
+    CavePVS pvs;
+    pvs.build(grid, jobs);
+    FrustumCuller culler(grid);
+    OcclusionCuller occlusion;
+    int totalFrames = ALLOC_WARMUP_FRAMES + checkFrames;
+    std::vector<glm::vec3> spots = testCameraSpots(grid, totalFrames);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+
+    AllocTracker& allocs = AllocTracker::get();
+    allocs.enabled = true;
+    AllocFrames simFrames;
+    std::thread renderer(renderLoop);
+    for (int frame = 0; frame < totalFrames; frame++) {
+        simFrames.beginFrame();
+        RenderList& list = renderQueue.writing();
+        glm::vec3 eye = spots[frame];
+        float yaw = frame * 0.7f;
+        glm::vec3 front(std::cos(yaw), 0.3f * std::sin(frame * 0.3f), std::sin(yaw));
+        glm::mat4 view = glm::lookAt(eye, eye + front, glm::vec3(0.0f, 1.0f, 0.0f));
+        cullIntoList(list, grid, NULL, culler, &pvs, &occlusion, projection * view, eye);
+        list.frame = frame;
+        list.view = view;
+        list.projection = projection;
+        renderQueue.publish();
+        simFrames.endFrame();
+    }
+    renderQueue.stop();
+    renderer.join();
+    allocs.enabled = false;
+
+    allocs.report(std::cout);
+    simFrames.report(std::cout, "simulation");
+    renderFrames.report(std::cout, "render");
+    bool clean = simFrames.steadyStateClean() && renderFrames.steadyStateClean();
+    std::cout << (clean ? "No allocations after warm-up" : "Frame loop allocated after warm-up") << std::endl;
+
+    renderQueue.discard();
+    delete(grid);
+    delete(jobs);
+    return clean ? 0 : -1;
+}
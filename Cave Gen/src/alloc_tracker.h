@@ -0,0 +1,260 @@
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+// distinct ALLOC_SCOPE names that get their own counters
+const int ALLOC_MAX_SCOPES = 32;
+// frames allowed to allocate while caches and pools fill up
+const int ALLOC_WARMUP_FRAMES = 120;
+
+class AllocScopeStats {
+public:
+	// a string literal, compared by address
+	std::atomic<const char*> name;
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> bytes;
+};
+
+class AllocTracker {
+public:
+	/*
+		Allocation tracking
+		---------------------
+		The file that defines ALLOC_TRACKER_IMPLEMENTATION (main.cpp)
+		replaces the global operator new and delete with versions that
+		count every allocation while enabled is set. When it is not set,
+		an allocation costs one extra relaxed load.
+		Counts are kept in three places:
+			- overall;
+			- per frame of a loop, in that loop's AllocFrames;
+			- per named ALLOC_SCOPE, which charges the allocations its own
+			  thread makes inside it to that name.
+		Nothing in here allocates, so the counters can be read inside the
+		loop they measure.
+		---------------------
+	*/
+	std::atomic<bool> enabled;
+	std::atomic<uint64_t> allocations;
+	std::atomic<uint64_t> frees;
+	std::atomic<uint64_t> bytes;
+
+	static AllocTracker& get() {
+		static AllocTracker tracker;
+		return tracker;
+	}
+
+	void onAlloc(size_t size) {
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(size, std::memory_order_relaxed);
+		threadAllocations()++;
+		threadBytes() += size;
+	}
+
+	void onFree() {
+		frees.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// allocations the calling thread has made while tracking was on
+	static uint64_t& threadAllocations() {
+		static thread_local uint64_t count = 0;
+		return count;
+	}
+
+	static uint64_t& threadBytes() {
+		static thread_local uint64_t count = 0;
+		return count;
+	}
+
+	AllocScopeStats* scope(const char* name) {
+		// claim the first free slot unless an earlier one already has this name
+		for (int i = 0; i < ALLOC_MAX_SCOPES; i++) {
+			const char* expected = NULL;
+			if (scopes[i].name.compare_exchange_strong(expected, name) || expected == name) {
+				return &scopes[i];
+			}
+		}
+		return NULL;
+	}
+
+	void report(std::ostream& os) const {
+		os << allocations << " allocations (" << bytes << " bytes), " << frees << " frees" << std::endl;
+		for (int i = 0; i < ALLOC_MAX_SCOPES; i++) {
+			const char* name = scopes[i].name;
+			if (name == NULL) {
+				break;
+			}
+			os << "  " << std::left << std::setw(16) << name << std::right << std::setw(10) << scopes[i].count
+				<< " allocations " << std::setw(12) << scopes[i].bytes << " bytes" << std::endl;
+		}
+	}
+
+private:
+	AllocScopeStats scopes[ALLOC_MAX_SCOPES];
+
+	AllocTracker() : enabled(false), allocations(0), frees(0), bytes(0) {
+		for (int i = 0; i < ALLOC_MAX_SCOPES; i++) {
+			scopes[i].name = NULL;
+			scopes[i].count = 0;
+			scopes[i].bytes = 0;
+		}
+	}
+};
+
+class AllocFrames {
+public:
+	/*
+		Per-frame counts for one loop, from the allocations of the thread
+		that runs it, so the simulation and render threads each get frames
+		of their own instead of charging each other's. Jobs a loop launches
+		allocate on the calling thread and are counted with it. After
+		ALLOC_WARMUP_FRAMES frames the loop is expected to allocate
+		nothing; frames that do are counted as steady-state allocations.
+	*/
+	// allocations made by the last finished frame
+	uint64_t frameAllocations;
+	long long frames;
+	// frames past the warm-up that allocated, and the most any one did
+	long long steadyFramesAllocating;
+	uint64_t steadyAllocations;
+	uint64_t worstFrame;
+
+	AllocFrames() {
+		frameAllocations = 0;
+		frames = 0;
+		steadyFramesAllocating = 0;
+		steadyAllocations = 0;
+		worstFrame = 0;
+		frameStart = 0;
+	}
+
+	// both from the thread running the loop
+	void beginFrame() {
+		frameStart = AllocTracker::threadAllocations();
+	}
+
+	void endFrame() {
+		frameAllocations = AllocTracker::threadAllocations() - frameStart;
+		frames++;
+		if (frames > ALLOC_WARMUP_FRAMES && frameAllocations > 0) {
+			steadyFramesAllocating++;
+			steadyAllocations += frameAllocations;
+			worstFrame = (frameAllocations > worstFrame) ? frameAllocations : worstFrame;
+		}
+	}
+
+	bool steadyStateClean() const {
+		return steadyFramesAllocating == 0;
+	}
+
+	void report(std::ostream& os, const char* loop) const {
+		os << loop << ": " << frames << " frames";
+		if (frames > ALLOC_WARMUP_FRAMES) {
+			os << ", " << frames - ALLOC_WARMUP_FRAMES << " after warm-up, " << steadyFramesAllocating << " of them allocated ("
+				<< steadyAllocations << " allocations, worst frame " << worstFrame << ")";
+		}
+		os << std::endl;
+	}
+
+private:
+	uint64_t frameStart;
+};
+
+class AllocScope {
+public:
+	AllocScope(const char* name) {
+		stats = NULL;
+		if (AllocTracker::get().enabled.load(std::memory_order_relaxed)) {
+			stats = AllocTracker::get().scope(name);
+			startCount = AllocTracker::threadAllocations();
+			startBytes = AllocTracker::threadBytes();
+		}
+	}
+
+	~AllocScope() {
+		if (stats != NULL) {
+			stats->count += AllocTracker::threadAllocations() - startCount;
+			stats->bytes += AllocTracker::threadBytes() - startBytes;
+		}
+	}
+
+private:
+	AllocScopeStats* stats;
+	uint64_t startCount;
+	uint64_t startBytes;
+};
+
+#define ALLOC_CONCAT_INNER(a, b) a##b
+#define ALLOC_CONCAT(a, b) ALLOC_CONCAT_INNER(a, b)
+// charges the calling thread's allocations in the rest of the scope to name
+#define ALLOC_SCOPE(name) AllocScope ALLOC_CONCAT(allocScope, __LINE__)(name)
+
+#ifdef ALLOC_TRACKER_IMPLEMENTATION
+
+void* operator new(size_t size) {
+	AllocTracker& tracker = AllocTracker::get();
+	if (tracker.enabled.load(std::memory_order_relaxed)) {
+		tracker.onAlloc(size);
+	}
+	void* p = malloc(size ? size : 1);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	AllocTracker& tracker = AllocTracker::get();
+	if (tracker.enabled.load(std::memory_order_relaxed)) {
+		tracker.onAlloc(size);
+	}
+	return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+	return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept {
+	if (p == NULL) {
+		return;
+	}
+	AllocTracker& tracker = AllocTracker::get();
+	if (tracker.enabled.load(std::memory_order_relaxed)) {
+		tracker.onFree();
+	}
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	operator delete(p);
+}
+
+#endif
+
+#endif
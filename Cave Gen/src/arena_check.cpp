@@ -0,0 +1,145 @@
+/*
+	Vertex arena free-list check
+	---------------------
+	g++ -O2 -std=c++17 -Iinclude src/arena_check.cpp -o cave_arena_check
+	./cave_arena_check [--ops N] [--seed N]
+	Runs random allocations and frees through ArenaFreeList, the
+	bookkeeping behind each VertexArena page, the way chunk meshes come
+	and go while streaming. A plain per-vertex map of the page is kept
+	alongside. After every step the free list has to match it exactly:
+	sorted, fully merged, and first-fit picking the same vertex. At the
+	end everything is freed and the page has to be one range again.
+	Exits non-zero on the first mismatch.
+	---------------------
+*/
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "gpu_upload.h"
+#include "test_cave.h"
+
+// small enough that allocations fail now and then, so the full case is covered too
+const int ARENA_CHECK_CAPACITY = 1 << 12;
+
+class Allocation {
+public:
+    int first;
+    int count;
+};
+
+void fail(int op, const char* what) {
+    std::cerr << "ERROR::ARENA_CHECK::OP_" << op << "::" << what << std::endl;
+}
+
+std::vector<ArenaRange> freeRuns(const std::vector<bool>& used) {
+    // what the free list should hold: every maximal run of unused vertices
+    std::vector<ArenaRange> runs;
+    int n = (int)used.size();
+    for (int i = 0; i < n;) {
+        if (used[i]) {
+            i++;
+            continue;
+        }
+        int start = i;
+        while (i < n && !used[i]) {
+            i++;
+        }
+        runs.push_back({ start, i - start });
+    }
+    return runs;
+}
+
+bool matches(const ArenaFreeList& list, const std::vector<bool>& used, int op) {
+    std::vector<ArenaRange> runs = freeRuns(used);
+    if (list.ranges.size() != runs.size()) {
+        fail(op, "RANGE_COUNT");
+        return false;
+    }
+    for (size_t i = 0; i < runs.size(); i++) {
+        if (list.ranges[i].first != runs[i].first || list.ranges[i].count != runs[i].count) {
+            fail(op, "RANGE");
+            return false;
+        }
+    }
+    return true;
+}
+
+int expectedFirst(const std::vector<bool>& used, int count) {
+    // first fit over the map; -1 if nothing is big enough
+    for (auto& run : freeRuns(used)) {
+        if (run.count >= count) {
+            return run.first;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    int ops = (int)intOption(argc, argv, "--ops", 100000);
+    unsigned int seed = (unsigned int)intOption(argc, argv, "--seed", 1);
+    std::mt19937 rng(seed);
+    ArenaFreeList list;
+    list.reset(ARENA_CHECK_CAPACITY);
+    std::vector<bool> used(ARENA_CHECK_CAPACITY, false);
+    std::vector<Allocation> live;
+    long long taken = 0;
+    long long refused = 0;
+    long long freed = 0;
+
+    for (int op = 0; op < ops; op++) {
+        // mostly small meshes, now and then a big one; free a bit less often than allocating
+        bool allocate = live.empty() || rng() % 100 < 55;
+        if (allocate) {
+            int count = (rng() % 16 == 0) ? 1 + (int)(rng() % 512) : 1 + (int)(rng() % 32);
+            int expected = expectedFirst(used, count);
+            int first = -1;
+            bool ok = list.take(count, &first);
+            if (ok != (expected >= 0)) {
+                fail(op, ok ? "TOOK_WITHOUT_ROOM" : "REFUSED_WITH_ROOM");
+                return -1;
+            }
+            if (!ok) {
+                refused++;
+                continue;
+            }
+            if (first != expected) {
+                fail(op, "NOT_FIRST_FIT");
+                return -1;
+            }
+            for (int v = first; v < first + count; v++) {
+                used[v] = true;
+            }
+            live.push_back({ first, count });
+            taken++;
+        }
+        else {
+            int i = (int)(rng() % live.size());
+            Allocation a = live[i];
+            live[i] = live.back();
+            live.pop_back();
+            list.give(a.first, a.count);
+            for (int v = a.first; v < a.first + a.count; v++) {
+                used[v] = false;
+            }
+            freed++;
+        }
+        if (!matches(list, used, op)) {
+            return -1;
+        }
+    }
+
+    std::shuffle(live.begin(), live.end(), rng);
+    for (auto& a : live) {
+        list.give(a.first, a.count);
+        freed++;
+    }
+    bool whole = list.ranges.size() == 1 && list.ranges[0].first == 0 && list.ranges[0].count == ARENA_CHECK_CAPACITY;
+    std::cout << ops << " ops: " << taken << " allocations, " << refused << " refused for lack of room, " << freed << " frees" << std::endl;
+    if (!whole) {
+        fail(ops, "NOT_MERGED_AFTER_FREEING_ALL");
+        return -1;
+    }
+    std::cout << "Free list matched the vertex map after every op" << std::endl;
+    return 0;
+}
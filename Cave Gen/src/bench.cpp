@@ -0,0 +1,326 @@
+/*
+	Generator benchmarks
+	---------------------
+	A separate entry point from main.cpp that needs no window or GL:
+		g++ -O2 -std=c++17 -Iinclude src/bench.cpp -lpthread -o cave_bench
+		./cave_bench [--quick] [--threads 1,2,4] [--out bench.json]
+	Every case runs at least BENCH_MIN_RUNS times and for BENCH_MIN_MS,
+	and the fastest run is reported. Results are printed as a table and
+	written as JSON, one object per case, so two builds can be diffed.
+	The threaded cases run at 1, 2, 4... up to the host's cores unless
+	--threads lists the counts, so on a single-core host they only have a
+	1-thread row; pass --threads to get a scaling curve anyway.
+	---------------------
+	The other headless entry points build the same way, each on its own,
+	and share the test cave and option parsing in test_cave.h:
+	- alloc_check.cpp: no allocations in the steady-state frame loop;
+	- arena_check.cpp: the vertex arena's free list;
+	- render_queue_check.cpp: the simulation -> render handoff;
+	- stream_bench.cpp: streaming and prefetch hit rate.
+	The checks exit non-zero when they fail.
+	---------------------
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "lsystem.h"
+#include "chunk.h"
+#include "mesher.h"
+#include "jobs.h"
+#include "memory.h"
+#include "test_cave.h"
+
+const int BENCH_MIN_RUNS = 3;
+const double BENCH_MIN_MS = 200.0;
+
+class BenchResult {
+public:
+    std::string name;
+    std::string variant;
+    long long size;
+    int threads;
+    double ms;
+    double throughput;
+    std::string unit;
+};
+
+std::vector<BenchResult> results;
+std::streambuf* coutBuffer = NULL;
+// from --threads, otherwise powers of two up to the host's cores
+std::vector<int> threadList;
+
+// the generator logs a lot; keep it out of the timings and the table
+void mute() {
+    coutBuffer = std::cout.rdbuf(NULL);
+}
+
+void unmute() {
+    std::cout.rdbuf(coutBuffer);
+    std::cout.clear();
+}
+
+double measure(const std::function<double()>& run) {
+    // run() returns the milliseconds of its timed part, so setup stays out
+    double best = 1e30;
+    double total = 0.0;
+    int runs = 0;
+    mute();
+    while (runs < BENCH_MIN_RUNS || total < BENCH_MIN_MS) {
+        double ms = run();
+        best = std::min(best, ms);
+        total += ms;
+        runs++;
+    }
+    unmute();
+    return best;
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void record(const std::string& name, const std::string& variant, long long size, int threads, double ms, double work, const std::string& unit) {
+    BenchResult r = { name, variant, size, threads, ms, work / (ms / 1000.0), unit };
+    results.push_back(r);
+    std::cout << std::left << std::setw(14) << name << std::setw(14) << variant << std::right << std::setw(10) << size
+        << std::setw(4) << threads << std::fixed << std::setprecision(3) << std::setw(12) << ms << " ms"
+        << std::scientific << std::setprecision(3) << std::setw(14) << r.throughput << " " << unit << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+std::string grammar(int iters, int cubes, const std::string& axiom, const std::string& rules) {
+    std::stringstream ss;
+    ss << iters << "\n" << cubes << "\n" << axiom << "\n" << rules;
+    return ss.str();
+}
+
+const char* DETERMINISTIC_RULES = "f : f+f-f\n";
+const char* STOCHASTIC_RULES = "f 0.5 : f+f\nf 0.3 : ff-\nf 0.2 : f\n";
+
+void benchApplyRules(const std::vector<int>& lengths) {
+    const char* variants[2] = { "deterministic", "stochastic" };
+    const char* rules[2] = { DETERMINISTIC_RULES, STOCHASTIC_RULES };
+    for (int v = 0; v < 2; v++) {
+        LSystem lsystem("bench");
+        lsystem.verbose = false;
+        mute();
+        lsystem.parseString(grammar(0, 4, "f", rules[v]));
+        unmute();
+        for (int length : lengths) {
+            // a third of the symbols have no rule and are copied through
+            std::string input;
+            for (int i = 0; i < length; i++) {
+                input += "ff+"[i % 3];
+            }
+            double ms = measure([&]() {
+                auto start = std::chrono::steady_clock::now();
+                std::string out = lsystem.applyRules(input);
+                return elapsedMs(start);
+            });
+            record("applyRules", variants[v], length, 1, ms, length, "symbols/s");
+        }
+    }
+}
+
+void benchParse(const std::vector<int>& ruleCounts) {
+    for (int count : ruleCounts) {
+        // commented, weighted rules so preprocessStream() has something to strip
+        std::stringstream rules;
+        for (int i = 0; i < count; i++) {
+            rules << "# rule " << i << "\n" << (char)('a' + i % 26) << " 0." << (1 + i % 9) << " : f+f-g" << i % 97 << "\n";
+        }
+        std::string text = grammar(0, 4, "f", rules.str());
+        double preprocessMs = measure([&]() {
+            auto start = std::chrono::steady_clock::now();
+            std::stringstream in(text);
+            std::stringstream out = preprocessStream(in);
+            return elapsedMs(start);
+        });
+        record("preprocess", "commented", count, 1, preprocessMs, (double)text.size(), "bytes/s");
+        double parseMs = measure([&]() {
+            LSystem lsystem("bench");
+            lsystem.verbose = false;
+            auto start = std::chrono::steady_clock::now();
+            lsystem.parseString(text);
+            return elapsedMs(start);
+        });
+        record("parse", "commented", count, 1, parseMs, (double)text.size(), "bytes/s");
+    }
+}
+
+std::vector<std::string> expand(const std::vector<int>& iterations) {
+    // real grammar output to walk: DETERMINISTIC_RULES from "f", at each count
+    LSystem lsystem("bench");
+    lsystem.verbose = false;
+    mute();
+    lsystem.parseString(grammar(0, 4, "f", DETERMINISTIC_RULES));
+    unmute();
+    std::vector<std::string> out;
+    std::string current = "f";
+    int done = 0;
+    for (int iters : iterations) {
+        for (; done < iters; done++) {
+            current = lsystem.applyRules(current);
+        }
+        out.push_back(current);
+    }
+    return out;
+}
+
+void benchMatrix(const std::vector<int>& sizes, const std::vector<int>& iterations) {
+    std::vector<std::string> paths = expand(iterations);
+    for (int size : sizes) {
+        double voxels = (double)size * size * size;
+        double ms = measure([&]() {
+            LSystem lsystem("bench");
+            lsystem.numCubes = size;
+            auto start = std::chrono::steady_clock::now();
+            lsystem.setupMatrix();
+            return elapsedMs(start);
+        });
+        record("setupMatrix", "calloc", size, 1, ms, voxels, "voxels/s");
+
+        LSystem lsystem("bench");
+        lsystem.verbose = false;
+        lsystem.numCubes = size;
+        lsystem.setupMatrix();
+        // drawGeometry walks +z from z = 0, one voxel per symbol, carving on each f
+        for (size_t i = 0; i < paths.size(); i++) {
+            const std::string& path = paths[i];
+            ms = measure([&]() {
+                auto start = std::chrono::steady_clock::now();
+                lsystem.drawGeometry(path);
+                return elapsedMs(start);
+            });
+            record("drawGeometry", "iters=" + std::to_string(iterations[i]), size, 1, ms, (double)path.size(), "symbols/s");
+        }
+    }
+}
+
+std::vector<int> threadCounts() {
+    if (!threadList.empty()) {
+        return threadList;
+    }
+    std::vector<int> counts;
+    int hardware = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int t = 1; t < hardware; t *= 2) {
+        counts.push_back(t);
+    }
+    counts.push_back(hardware);
+    return counts;
+}
+
+void benchCaves(const std::vector<int>& sizes, int maxCubeSize) {
+    std::vector<int> threads = threadCounts();
+    for (int size : sizes) {
+        LSystem lsystem("bench");
+        lsystem.verbose = false;
+        lsystem.numCubes = size;
+        lsystem.setupMatrix();
+        carveTestCave(lsystem);
+        double voxels = (double)size * size * size;
+
+        for (int t : threads) {
+            JobSystem jobs(t);
+            if (size <= maxCubeSize) {
+                // one heap Cube per rock voxel, so only the smaller grids
+                double ms = measure([&]() {
+                    auto start = std::chrono::steady_clock::now();
+                    lsystem.writeCubes(&jobs);
+                    double elapsed = elapsedMs(start);
+                    lsystem.clearCubes();
+                    return elapsed;
+                });
+                record("writeCubes", "caves", size, t, ms, voxels, "voxels/s");
+            }
+
+            double ms = measure([&]() {
+                auto start = std::chrono::steady_clock::now();
+                VoxelGrid grid(lsystem.matrix, size, &jobs);
+                return elapsedMs(start);
+            });
+            record("voxelize", "caves", size, t, ms, voxels, "voxels/s");
+
+            VoxelGrid grid(lsystem.matrix, size, &jobs);
+            std::vector<std::vector<packedVertex>> meshes(grid.chunks.size());
+            const char* modeNames[2] = { "culled", "greedy" };
+            meshMode modes[2] = { CULLED, GREEDY };
+            for (int m = 0; m < 2; m++) {
+                ms = measure([&]() {
+                    auto start = std::chrono::steady_clock::now();
+                    jobs.parallelForEach((int)grid.chunks.size(), [&](int i) {
+                        static thread_local Mesher mesher;
+                        mesher.mode = modes[m];
+                        mesher.mesh(&grid, grid.chunks[i], meshes[i]);
+                    });
+                    return elapsedMs(start);
+                });
+                record("mesh", modeNames[m], size, t, ms, voxels, "voxels/s");
+            }
+        }
+    }
+}
+
+bool writeJson(const std::string& path) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    file << "{\n  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        file << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"variant\": \"" << r.variant << "\", \"size\": " << r.size
+            << ", \"threads\": " << r.threads << ", \"ms\": " << std::setprecision(6) << r.ms
+            << ", \"throughput\": " << r.throughput << ", \"unit\": \"" << r.unit << "\"}";
+    }
+    file << "\n  ]\n}" << std::endl;
+    std::cout << "Wrote " << results.size() << " results to " << path << std::endl;
+    return (bool)file;
+}
+
+int main(int argc, char** argv) {
+    std::string outPath = "bench.json";
+    bool quick = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        }
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            std::stringstream list(argv[++i]);
+            std::string count;
+            while (std::getline(list, count, ',')) {
+                threadList.push_back(std::max(1, atoi(count.c_str())));
+            }
+        }
+    }
+    MemoryTracker::get().quiet = true;
+
+    std::cout << std::left << std::setw(14) << "case" << std::setw(14) << "variant" << std::right << std::setw(10) << "size"
+        << std::setw(4) << "thr" << std::setw(15) << "best" << std::setw(14) << "throughput" << std::endl;
+    if (quick) {
+        benchApplyRules({ 1000, 10000 });
+        benchParse({ 100, 1000 });
+        benchMatrix({ 32, 64 }, { 4, 8 });
+        benchCaves({ 32, 64 }, 64);
+    }
+    else {
+        benchApplyRules({ 1000, 10000, 100000 });
+        benchParse({ 100, 1000, 10000 });
+        benchMatrix({ 64, 128, 256 }, { 4, 8, 12 });
+        benchCaves({ 64, 128, 256 }, 128);
+    }
+    return writeJson(outPath) ? 0 : -1;
+}
@@ -105,6 +105,15 @@ public:
 		updateCameraVectors();
 	}
 
+	void SetView(glm::vec3 pos, float yaw, float pitch, float fov) {
+		// for replays, which set the whole state rather than nudging it
+		Pos = pos;
+		Yaw = yaw;
+		Pitch = pitch;
+		Fov = fov;
+		updateCameraVectors();
+	}
+
 	void ProcessMouseScroll(float yoffset) {
 		Fov -= yoffset;
 		if (Fov < 1.0f)
@@ -0,0 +1,287 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <glm/glm.hpp>
+#include "cube.h"
+#include "jobs.h"
+#include "memory.h"
+#include "tracer.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+const int CHUNK_SIZE = 32;
+const int CHUNK_PAD = CHUNK_SIZE + 2;
+// 8^3 voxel bricks, 4^3 = 64 per chunk so one bit each in a uint64_t
+const int BRICK_SIZE = 8;
+const int BRICKS_PER_SIDE = CHUNK_SIZE / BRICK_SIZE;
+const int BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+typedef enum material {
+	AIR = 0,
+	ROCK = 1
+} material;
+
+// face 2 * axis for the positive side, 2 * axis + 1 for the negative one
+typedef enum faceDir {
+	POS_X,
+	NEG_X,
+	POS_Y,
+	NEG_Y,
+	POS_Z,
+	NEG_Z
+} faceDir;
+
+inline int ctz32(uint32_t v) {
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward(&idx, v);
+	return (int)idx;
+#else
+	return __builtin_ctz(v);
+#endif
+}
+
+inline int ctz64(uint64_t v) {
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward64(&idx, v);
+	return (int)idx;
+#else
+	return __builtin_ctzll(v);
+#endif
+}
+
+class Chunk {
+public:
+	glm::ivec3 coord;
+	// voxels[x][y][z], material id per voxel
+	unsigned char voxels[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE];
+	// solid[x][y] has bit z set when voxels[x][y][z] != AIR
+	uint32_t solid[CHUNK_SIZE][CHUNK_SIZE];
+	int solidCount;
+	// solid voxels per brick, and bit masks of bricks that are full / not empty
+	unsigned short brickCount[BRICKS_PER_SIDE * BRICKS_PER_SIDE * BRICKS_PER_SIDE];
+	uint64_t fullBricks;
+	uint64_t usedBricks;
+	// set when the chunk's mesh no longer matches its voxels
+	bool dirty;
+	// frustum state from the last cull
+	inView view;
+
+	// vertices in the mesh last handed to the renderer, 0 when there is nothing to draw
+	int vertexCount;
+
+	Chunk(glm::ivec3 c) {
+		coord = c;
+		memset(voxels, AIR, sizeof(voxels));
+		memset(solid, 0, sizeof(solid));
+		solidCount = 0;
+		memset(brickCount, 0, sizeof(brickCount));
+		fullBricks = 0;
+		usedBricks = 0;
+		dirty = false;
+		view = TOCHECK;
+		vertexCount = 0;
+	}
+
+	unsigned char get(int x, int y, int z) const {
+		return voxels[x][y][z];
+	}
+
+	void set(int x, int y, int z, unsigned char m) {
+		uint32_t bit = 1u << z;
+		bool wasSolid = (solid[x][y] & bit) != 0;
+		voxels[x][y][z] = m;
+		if (m != AIR) {
+			solid[x][y] |= bit;
+		}
+		else {
+			solid[x][y] &= ~bit;
+		}
+		if (wasSolid == (m != AIR)) {
+			return;
+		}
+
+		int delta = wasSolid ? -1 : 1;
+		int b = brickIndex(x / BRICK_SIZE, y / BRICK_SIZE, z / BRICK_SIZE);
+		uint64_t brickBit = 1ull << b;
+		solidCount += delta;
+		brickCount[b] += delta;
+		fullBricks = (brickCount[b] == BRICK_VOXELS) ? (fullBricks | brickBit) : (fullBricks & ~brickBit);
+		usedBricks = (brickCount[b] > 0) ? (usedBricks | brickBit) : (usedBricks & ~brickBit);
+	}
+
+	static int brickIndex(int bx, int by, int bz) {
+		return (bx * BRICKS_PER_SIDE + by) * BRICKS_PER_SIDE + bz;
+	}
+
+	bool empty() const {
+		return solidCount == 0;
+	}
+};
+
+class VoxelGrid {
+public:
+	int size;
+	int chunksPerSide;
+	// world position of the minimum corner of voxel (0, 0, 0)
+	glm::vec3 origin;
+	std::vector<Chunk*> chunks;
+	std::vector<Chunk*> dirtyChunks;
+
+	VoxelGrid(char*** matrix, int numCubes, JobSystem* jobs = NULL) {
+		TRACE_ZONE("VoxelGrid fill");
+		size = numCubes;
+		chunksPerSide = (numCubes + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		int mid = numCubes / 2;
+		origin = glm::vec3(mid - numCubes + 1 - 0.5f);
+
+		for (int cx = 0; cx < chunksPerSide; cx++) {
+			for (int cy = 0; cy < chunksPerSide; cy++) {
+				for (int cz = 0; cz < chunksPerSide; cz++) {
+					chunks.push_back(new Chunk(glm::ivec3(cx, cy, cz)));
+				}
+			}
+		}
+		MemoryTracker::get().add(MEM_VOXELS, chunks.size() * sizeof(Chunk));
+
+		// chunks are filled independently, so this splits cleanly across workers
+		if (jobs != NULL) {
+			jobs->parallelForEach((int)chunks.size(), [&](int i) {
+				fillChunk(matrix, chunks[i]);
+			});
+		}
+		else {
+			for (auto chunk : chunks) {
+				fillChunk(matrix, chunk);
+			}
+		}
+
+		for (auto chunk : chunks) {
+			if (!chunk->empty()) {
+				markDirty(chunk);
+			}
+		}
+	}
+
+	~VoxelGrid() {
+		for (auto chunk : chunks) {
+			delete(chunk);
+		}
+		MemoryTracker::get().release(MEM_VOXELS, chunks.size() * sizeof(Chunk));
+	}
+
+	VoxelGrid* snapshot() const {
+		// a copy of the voxels for a job to read while this grid keeps being edited
+		VoxelGrid* copy = new VoxelGrid(NULL, 0);
+		copy->size = size;
+		copy->chunksPerSide = chunksPerSide;
+		copy->origin = origin;
+		copy->chunks.reserve(chunks.size());
+		for (auto chunk : chunks) {
+			Chunk* c = new Chunk(*chunk);
+			c->dirty = false;
+			copy->chunks.push_back(c);
+		}
+		MemoryTracker::get().add(MEM_VOXELS, chunks.size() * sizeof(Chunk));
+		return copy;
+	}
+
+	Chunk* chunkAt(int cx, int cy, int cz) const {
+		if (cx < 0 || cy < 0 || cz < 0 || cx >= chunksPerSide || cy >= chunksPerSide || cz >= chunksPerSide) {
+			return NULL;
+		}
+		return chunks[(cx * chunksPerSide + cy) * chunksPerSide + cz];
+	}
+
+	Chunk* chunkAt(glm::ivec3 c) const {
+		return chunkAt(c.x, c.y, c.z);
+	}
+
+	bool inBounds(int x, int y, int z) const {
+		return x >= 0 && y >= 0 && z >= 0 && x < size && y < size && z < size;
+	}
+
+	unsigned char getVoxel(int x, int y, int z) const {
+		if (!inBounds(x, y, z)) {
+			return AIR;
+		}
+		Chunk* chunk = chunkAt(x / CHUNK_SIZE, y / CHUNK_SIZE, z / CHUNK_SIZE);
+		return chunk->get(x % CHUNK_SIZE, y % CHUNK_SIZE, z % CHUNK_SIZE);
+	}
+
+	void setVoxel(int x, int y, int z, unsigned char m) {
+		if (!inBounds(x, y, z)) {
+			return;
+		}
+		glm::ivec3 c(x / CHUNK_SIZE, y / CHUNK_SIZE, z / CHUNK_SIZE);
+		glm::ivec3 l(x % CHUNK_SIZE, y % CHUNK_SIZE, z % CHUNK_SIZE);
+		Chunk* chunk = chunkAt(c);
+		if (chunk->get(l.x, l.y, l.z) == m) {
+			return;
+		}
+		chunk->set(l.x, l.y, l.z, m);
+
+		// voxels on a border also feed the neighbours' face culling and AO
+		glm::ivec3 lo, hi;
+		for (int a = 0; a < 3; a++) {
+			lo[a] = (l[a] == 0) ? -1 : 0;
+			hi[a] = (l[a] == CHUNK_SIZE - 1) ? 1 : 0;
+		}
+		for (int dx = lo.x; dx <= hi.x; dx++) {
+			for (int dy = lo.y; dy <= hi.y; dy++) {
+				for (int dz = lo.z; dz <= hi.z; dz++) {
+					markDirty(chunkAt(c.x + dx, c.y + dy, c.z + dz));
+				}
+			}
+		}
+	}
+
+	void markDirty(Chunk* chunk) {
+		if (chunk == NULL || chunk->dirty) {
+			return;
+		}
+		chunk->dirty = true;
+		dirtyChunks.push_back(chunk);
+	}
+
+	void markAllDirty() {
+		for (auto chunk : chunks) {
+			markDirty(chunk);
+		}
+	}
+
+	void fillChunk(char*** matrix, Chunk* chunk) {
+		/*
+			Grid voxel g maps to matrix index size - 1 - g so that voxel
+			centres land on the same world positions writeCubes() uses
+			(mid - i). Matrix cells left at 0 are rock, anything else has
+			been carved out.
+		*/
+		glm::ivec3 base = chunk->coord * CHUNK_SIZE;
+		for (int x = 0; x < CHUNK_SIZE && base.x + x < size; x++) {
+			for (int y = 0; y < CHUNK_SIZE && base.y + y < size; y++) {
+				for (int z = 0; z < CHUNK_SIZE && base.z + z < size; z++) {
+					char cell = matrix[size - 1 - base.x - x][size - 1 - base.y - y][size - 1 - base.z - z];
+					if (cell == 0) {
+						chunk->set(x, y, z, ROCK);
+					}
+				}
+			}
+		}
+	}
+
+	glm::ivec3 worldToVoxel(glm::vec3 pos) const {
+		return glm::ivec3(glm::floor(pos - origin));
+	}
+
+	glm::vec3 chunkOrigin(const Chunk* chunk) const {
+		return origin + glm::vec3(chunk->coord * CHUNK_SIZE);
+	}
+};
+
+#endif
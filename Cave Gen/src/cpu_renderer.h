@@ -0,0 +1,188 @@
+#ifndef CPU_RENDERER_H
+#define CPU_RENDERER_H
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "camera.h"
+#include "chunk.h"
+#include "jobs.h"
+#include "memory.h"
+#include "png_writer.h"
+#include "raycast.h"
+#include "stb_image.h"
+#include "tracer.h"
+
+// pixels per side of a render tile, a multiple of RAY_PACKET
+const int RENDER_TILE = 16;
+
+class CpuRenderer {
+public:
+	/*
+		CPU ray tracer
+		---------------------
+		The image is cut into RENDER_TILE^2 tiles, one job each, so every
+		core gets work. Each tile row is traced as ray packets of
+		neighbouring pixels, which stay coherent through the grid.
+		Hits are shaded the way the chunk shaders do it: the texture is
+		tiled along the face's u/v axes (as in shaders/v.glsl) and darkened
+		by the same corner AO curve, interpolated across the face, with a
+		headlight on top.
+		---------------------
+		Needs no GL context, so previews can be rendered on build servers.
+	*/
+	int width;
+	int height;
+	// RGB, top row first
+	std::vector<unsigned char> pixels;
+	double renderMs;
+
+	CpuRenderer(const VoxelGrid* g, JobSystem* j) : caster(g) {
+		grid = g;
+		jobs = j;
+		width = 0;
+		height = 0;
+		renderMs = 0.0;
+		texture = NULL;
+		texWidth = 0;
+		texHeight = 0;
+	}
+
+	~CpuRenderer() {
+		if (texture != NULL) {
+			stbi_image_free(texture);
+			MemoryTracker::get().release(MEM_TEXTURES, (int64_t)texWidth * texHeight * 3);
+		}
+	}
+
+	bool loadTexture(const std::string& path) {
+		// flipped like textureSetup() so v = 0 is the bottom row
+		int channels;
+		stbi_set_flip_vertically_on_load(true);
+		texture = stbi_load(path.c_str(), &texWidth, &texHeight, &channels, 3);
+		if (texture == NULL) {
+			std::cerr << "Failed to load texture " << path << std::endl;
+			return false;
+		}
+		MemoryTracker::get().add(MEM_TEXTURES, (int64_t)texWidth * texHeight * 3);
+		return true;
+	}
+
+	void render(const Camera& cam, int w, int h) {
+		auto start = std::chrono::steady_clock::now();
+		width = w;
+		height = h;
+		pixels.assign((size_t)w * h * 3, 0);
+
+		// half extents of the image plane one unit in front of the camera
+		float halfH = std::tan(glm::radians(cam.Fov) * 0.5f);
+		float halfW = halfH * (float)w / (float)h;
+		glm::vec3 right = cam.Right * halfW;
+		glm::vec3 up = cam.Up * halfH;
+
+		int tilesX = (w + RENDER_TILE - 1) / RENDER_TILE;
+		int tilesY = (h + RENDER_TILE - 1) / RENDER_TILE;
+		jobs->parallelFor(0, tilesX * tilesY, 1, [&](int from, int to) {
+			for (int tile = from; tile < to; tile++) {
+				renderTile((tile % tilesX) * RENDER_TILE, (tile / tilesX) * RENDER_TILE, cam.Pos, cam.Front, right, up);
+			}
+		});
+		renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	bool save(const std::string& path) const {
+		return writePNG(path, width, height, pixels);
+	}
+
+private:
+	const VoxelGrid* grid;
+	JobSystem* jobs;
+	Raycaster caster;
+	unsigned char* texture;
+	int texWidth;
+	int texHeight;
+
+	void renderTile(int x0, int y0, glm::vec3 eye, glm::vec3 front, glm::vec3 right, glm::vec3 up) {
+		TRACE_ZONE("render tile");
+		glm::vec3 origins[RAY_PACKET];
+		glm::vec3 dirs[RAY_PACKET];
+		RayHit hits[RAY_PACKET];
+		for (int i = 0; i < RAY_PACKET; i++) {
+			origins[i] = eye;
+		}
+		for (int y = y0; y < y0 + RENDER_TILE && y < height; y++) {
+			float ndcY = 1.0f - 2.0f * (y + 0.5f) / height;
+			for (int x = x0; x < x0 + RENDER_TILE && x < width; x += RAY_PACKET) {
+				for (int i = 0; i < RAY_PACKET; i++) {
+					float ndcX = 2.0f * (x + i + 0.5f) / width - 1.0f;
+					dirs[i] = glm::normalize(front + right * ndcX + up * ndcY);
+				}
+				caster.castPacket(origins, dirs, 1e6f, hits);
+				for (int i = 0; i < RAY_PACKET && x + i < width; i++) {
+					glm::vec3 c = shade(eye, dirs[i], hits[i]);
+					unsigned char* p = &pixels[((size_t)y * width + x + i) * 3];
+					p[0] = (unsigned char)(glm::clamp(c.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+					p[1] = (unsigned char)(glm::clamp(c.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+					p[2] = (unsigned char)(glm::clamp(c.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+				}
+			}
+		}
+	}
+
+	bool solid(glm::ivec3 v) const {
+		return grid->getVoxel(v.x, v.y, v.z) != AIR;
+	}
+
+	glm::vec3 shade(glm::vec3 eye, glm::vec3 dir, const RayHit& hit) const {
+		if (!hit.hit) {
+			// the window's clear colour
+			return glm::vec3(0.2f, 0.3f, 0.3f);
+		}
+		if (hit.face < 0) {
+			// started inside rock
+			return glm::vec3(0.0f);
+		}
+		int axis = hit.face / 2;
+		glm::ivec3 n(0);
+		n[axis] = (hit.face % 2 == 0) ? 1 : -1;
+		// same u/v axes as the mesher and shaders/v.glsl
+		int uAxis = (axis == 2) ? 0 : 2;
+		int vAxis = (axis == 1) ? 0 : 1;
+		glm::vec3 p = eye - grid->origin + dir * hit.distance;
+		float fu = glm::clamp(p[uAxis] - (float)hit.voxel[uAxis], 0.0f, 1.0f);
+		float fv = glm::clamp(p[vAxis] - (float)hit.voxel[vAxis], 0.0f, 1.0f);
+
+		// corner AO as in the mesher, blended across the face
+		const float aoCurve[4] = { 0.35f, 0.55f, 0.8f, 1.0f };
+		glm::ivec3 front = hit.voxel + n;
+		glm::ivec3 du(0), dv(0);
+		du[uAxis] = 1;
+		dv[vAxis] = 1;
+		float ao = 0.0f;
+		for (int su = 0; su < 2; su++) {
+			for (int sv = 0; sv < 2; sv++) {
+				glm::ivec3 ou = du * (su ? 1 : -1);
+				glm::ivec3 ov = dv * (sv ? 1 : -1);
+				int side1 = solid(front + ou);
+				int side2 = solid(front + ov);
+				int corner = solid(front + ou + ov);
+				int level = (side1 && side2) ? 0 : 3 - (side1 + side2 + corner);
+				ao += aoCurve[level] * (su ? fu : 1.0f - fu) * (sv ? fv : 1.0f - fv);
+			}
+		}
+
+		glm::vec3 albedo(0.6f);
+		if (texture != NULL) {
+			int tx = std::min((int)(fu * texWidth), texWidth - 1);
+			int ty = std::min((int)(fv * texHeight), texHeight - 1);
+			const unsigned char* t = &texture[((size_t)ty * texWidth + tx) * 3];
+			albedo = glm::vec3(t[0], t[1], t[2]) / 255.0f;
+		}
+		float light = 0.35f + 0.65f * std::max(-glm::dot(glm::vec3(n), dir), 0.0f);
+		return albedo * ao * light;
+	}
+};
+
+#endif
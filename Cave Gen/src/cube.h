@@ -1,6 +1,7 @@
 #ifndef CUBE_H
 #define CUBE_H
 
+#include <algorithm>
 #include <glm/ext.hpp>
 
 typedef enum inView {
@@ -34,8 +35,32 @@ public:
 		view = TOCHECK;
 	}
 
-	void rayIntersection(glm::vec3 ray) {
-		return;
+	bool rayIntersection(glm::vec3 origin, glm::vec3 dir, float& t) {
+		// slab test; t is where the ray enters, in multiples of dir
+		glm::vec3 lo(minX, minY, minZ);
+		glm::vec3 hi(maxX, maxY, maxZ);
+		float tNear = 0.0f;
+		float tFar = 1e30f;
+		for (int a = 0; a < 3; a++) {
+			if (dir[a] == 0.0f) {
+				if (origin[a] < lo[a] || origin[a] > hi[a]) {
+					return false;
+				}
+				continue;
+			}
+			float t0 = (lo[a] - origin[a]) / dir[a];
+			float t1 = (hi[a] - origin[a]) / dir[a];
+			if (t0 > t1) {
+				std::swap(t0, t1);
+			}
+			tNear = std::max(tNear, t0);
+			tFar = std::min(tFar, t1);
+			if (tNear > tFar) {
+				return false;
+			}
+		}
+		t = tNear;
+		return true;
 	}
 };
 
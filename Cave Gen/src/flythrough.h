@@ -0,0 +1,103 @@
+#ifndef FLYTHROUGH_H
+#define FLYTHROUGH_H
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "camera.h"
+
+// simulated seconds per replayed frame
+const double REPLAY_STEP = 1.0 / 60.0;
+
+class CameraKey {
+public:
+	double time;
+	glm::vec3 pos;
+	float yaw;
+	float pitch;
+	float fov;
+};
+
+class Flythrough {
+public:
+	/*
+		Camera flythroughs
+		---------------------
+		CFLY 1
+		time pos.x pos.y pos.z yaw pitch fov
+		...
+		---------------------
+		Recording stores the camera once per frame, stamped with seconds
+		since recording started. A replay ignores real time. Frame n shows
+		the path at n * REPLAY_STEP, interpolated between the two
+		neighbouring keys. So every replay of a file renders the same views
+		in the same order, however fast the machine runs it.
+	*/
+	std::vector<CameraKey> keys;
+
+	void record(double time, const Camera& cam) {
+		keys.push_back({ time, cam.Pos, cam.Yaw, cam.Pitch, cam.Fov });
+	}
+
+	bool save(const std::string& path) const {
+		std::ofstream file(path);
+		if (!file.is_open()) {
+			std::cerr << "Failed to open " << path << std::endl;
+			return false;
+		}
+		file.precision(9);
+		file << "CFLY 1" << std::endl;
+		for (auto& k : keys) {
+			file << k.time << " " << k.pos.x << " " << k.pos.y << " " << k.pos.z << " " << k.yaw << " " << k.pitch << " " << k.fov << "\n";
+		}
+		std::cout << "Recorded " << keys.size() << " frames (" << duration() << " s) to " << path << std::endl;
+		return (bool)file;
+	}
+
+	bool load(const std::string& path) {
+		std::ifstream file(path);
+		std::string magic;
+		int version = 0;
+		if (!file.is_open() || !(file >> magic >> version) || magic != "CFLY" || version != 1) {
+			std::cerr << "Failed to load flythrough " << path << std::endl;
+			return false;
+		}
+		keys.clear();
+		CameraKey k;
+		while (file >> k.time >> k.pos.x >> k.pos.y >> k.pos.z >> k.yaw >> k.pitch >> k.fov) {
+			keys.push_back(k);
+		}
+		if (keys.empty()) {
+			std::cerr << "Flythrough " << path << " has no frames" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	double duration() const {
+		return keys.empty() ? 0.0 : keys.back().time;
+	}
+
+	int frameCount() const {
+		return (int)(duration() / REPLAY_STEP) + 1;
+	}
+
+	void apply(int frame, Camera& cam) const {
+		double t = frame * REPLAY_STEP;
+		auto next = std::upper_bound(keys.begin(), keys.end(), t, [](double time, const CameraKey& k) { return time < k.time; });
+		if (next == keys.begin() || next == keys.end()) {
+			const CameraKey& k = (next == keys.end()) ? keys.back() : keys.front();
+			cam.SetView(k.pos, k.yaw, k.pitch, k.fov);
+			return;
+		}
+		const CameraKey& a = *(next - 1);
+		const CameraKey& b = *next;
+		float f = (float)((t - a.time) / (b.time - a.time));
+		cam.SetView(glm::mix(a.pos, b.pos, f), glm::mix(a.yaw, b.yaw, f), glm::mix(a.pitch, b.pitch, f), glm::mix(a.fov, b.fov, f));
+	}
+};
+
+#endif
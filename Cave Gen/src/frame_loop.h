@@ -0,0 +1,103 @@
+#ifndef FRAME_LOOP_H
+#define FRAME_LOOP_H
+
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "alloc_tracker.h"
+#include "chunk.h"
+#include "frustum.h"
+#include "gpu_upload.h"
+#include "jobs.h"
+#include "occlusion.h"
+#include "profiler.h"
+#include "pvs.h"
+#include "render_queue.h"
+#include "stream.h"
+#include "tracer.h"
+
+/*
+	The parts of a frame that need no GL, on both sides of the render
+	queue. main.cpp runs its frames through these, and so does
+	alloc_check.cpp, so the allocation check covers the code that ships.
+*/
+
+inline void cullIntoList(RenderList& list, VoxelGrid* grid, StreamingWorld* world, FrustumCuller& culler,
+	const CavePVS* pvs, OcclusionCuller* occlusion, const glm::mat4& viewProj, glm::vec3 eye) {
+	// simulation thread: frustum, then PVS and occlusion when given, into list's draws and culled counts
+	TRACE_ZONE("culling");
+	ALLOC_SCOPE("culling");
+	if (world != NULL) {
+		world->cull(viewProj, culler.visible);
+	}
+	else {
+		culler.cull(viewProj);
+	}
+	int inFrustum = (int)culler.visible.size();
+	if (pvs != NULL) {
+		pvs->filter(pvs->cellAt(grid, eye), culler.visible);
+	}
+	int inCell = (int)culler.visible.size();
+	if (occlusion != NULL) {
+		occlusion->cull(grid, viewProj, eye, culler.visible);
+	}
+	int candidates = (world != NULL) ? world->loaded() : (int)grid->chunks.size();
+	list.frustumCulled = candidates - inFrustum;
+	list.pvsCulled = inFrustum - inCell;
+	list.occlusionCulled = inCell - (int)culler.visible.size();
+	for (auto chunk : culler.visible) {
+		list.draws.push_back({ chunk, (world != NULL) ? world->chunkOrigin(chunk) : grid->chunkOrigin(chunk) });
+	}
+}
+
+inline bool acquireFrame(RenderQueue& queue, RenderList** list, bool* fresh) {
+	// render thread: false when there is nothing to draw yet, or stop() woke a lockstep wait
+	*fresh = queue.acquire(list);
+	if (!*fresh && queue.lockstep) {
+		return false;
+	}
+	if ((*list)->frame < 0) {
+		std::this_thread::yield();
+		return false;
+	}
+	return true;
+}
+
+inline void beginRenderFrame(const RenderList& list, bool fresh, FrameProfiler& profiler, AllocFrames& frames) {
+	frames.beginFrame();
+	profiler.beginFrame();
+	if (fresh) {
+		// the simulation's phases, once per list
+		profiler.addPhase(PHASE_INPUT, list.inputMs);
+		profiler.addPhase(PHASE_UPDATE, list.updateMs);
+		profiler.addPhase(PHASE_CULLING, list.cullingMs);
+	}
+}
+
+inline void runRenderWork(JobSystem* jobs, RenderList& list, UploadScheduler& uploads) {
+	// jobs queued with runOnRenderThread(), then the list's mesh changes in the order they were made
+	jobs->runPending();
+	for (auto& op : list.meshOps) {
+		if (op.release) {
+			uploads.release(op.chunk);
+		}
+		else {
+			uploads.submit(op.chunk, op.vertices);
+		}
+	}
+	list.meshOps.clear();
+}
+
+inline void countRenderFrame(FrameProfiler& profiler, const RenderList& list, bool fresh, int drawCalls, int chunksDrawn) {
+	// a redrawn list was already counted the first time
+	if (fresh) {
+		profiler.count(drawCalls, chunksDrawn, list.frustumCulled, list.pvsCulled, list.occlusionCulled);
+	}
+}
+
+inline void endRenderFrame(FrameProfiler& profiler, AllocFrames& frames) {
+	profiler.endFrame();
+	frames.endFrame();
+}
+
+#endif
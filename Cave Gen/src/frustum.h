@@ -0,0 +1,230 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "cube.h"
+#include "chunk.h"
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+// chunks per side of a culling region
+const int REGION_CHUNKS = 4;
+
+class Frustum {
+public:
+	// left, right, bottom, top, near, far; inside when dot(plane, (p, 1)) >= 0
+	glm::vec4 planes[6];
+
+	Frustum() {}
+
+	Frustum(const glm::mat4& viewProj) {
+		// Gribb / Hartmann: rows of the clip matrix added to / subtracted from w
+		glm::mat4 m = glm::transpose(viewProj);
+		planes[0] = m[3] + m[0];
+		planes[1] = m[3] - m[0];
+		planes[2] = m[3] + m[1];
+		planes[3] = m[3] - m[1];
+		planes[4] = m[3] + m[2];
+		planes[5] = m[3] - m[2];
+		for (int i = 0; i < 6; i++) {
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+		}
+	}
+};
+
+class BoxList {
+public:
+	// structure of arrays, padded to a multiple of 8 with boxes that are never read back
+	std::vector<float> minX, minY, minZ;
+	std::vector<float> maxX, maxY, maxZ;
+	int count;
+
+	BoxList() {
+		count = 0;
+	}
+
+	void add(glm::vec3 lo, glm::vec3 hi) {
+		if (count % 8 == 0) {
+			int padded = count + 8;
+			minX.resize(padded, 0.0f);
+			minY.resize(padded, 0.0f);
+			minZ.resize(padded, 0.0f);
+			maxX.resize(padded, 0.0f);
+			maxY.resize(padded, 0.0f);
+			maxZ.resize(padded, 0.0f);
+		}
+		minX[count] = lo.x;
+		minY[count] = lo.y;
+		minZ[count] = lo.z;
+		maxX[count] = hi.x;
+		maxY[count] = hi.y;
+		maxZ[count] = hi.z;
+		count++;
+	}
+
+	void pad() {
+		// start the next box on an 8-wide boundary
+		while (count % 8 != 0) {
+			add(glm::vec3(0.0f), glm::vec3(0.0f));
+		}
+	}
+
+	void classify(const Frustum& f, int first, int n, inView* out) const {
+		/*
+			first must be a multiple of 8.
+
+			NOLOAD when the box is behind any plane, LOAD when it is in front
+			of all of them, TOCHECK when it straddles one. Per plane only the
+			corner furthest along the normal (p) and the nearest one (n)
+			matter; the plane is the same for every lane, so choosing them is
+			a per-plane pick of the min or max arrays.
+		*/
+#ifdef FRUSTUM_SSE
+		for (int i = first; i < first + n; i += 8) {
+			__m128 outsideLo = _mm_setzero_ps(), outsideHi = _mm_setzero_ps();
+			__m128 partialLo = _mm_setzero_ps(), partialHi = _mm_setzero_ps();
+			__m128 zero = _mm_setzero_ps();
+			for (int p = 0; p < 6; p++) {
+				const glm::vec4& pl = f.planes[p];
+				const float* px = (pl.x > 0) ? &maxX[i] : &minX[i];
+				const float* py = (pl.y > 0) ? &maxY[i] : &minY[i];
+				const float* pz = (pl.z > 0) ? &maxZ[i] : &minZ[i];
+				const float* nx = (pl.x > 0) ? &minX[i] : &maxX[i];
+				const float* ny = (pl.y > 0) ? &minY[i] : &maxY[i];
+				const float* nz = (pl.z > 0) ? &minZ[i] : &maxZ[i];
+				__m128 a = _mm_set1_ps(pl.x);
+				__m128 b = _mm_set1_ps(pl.y);
+				__m128 c = _mm_set1_ps(pl.z);
+				__m128 d = _mm_set1_ps(pl.w);
+
+				for (int half = 0; half < 2; half++) {
+					int o = half * 4;
+					__m128 dp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(px + o)), _mm_mul_ps(b, _mm_loadu_ps(py + o))),
+						_mm_add_ps(_mm_mul_ps(c, _mm_loadu_ps(pz + o)), d));
+					__m128 dn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(nx + o)), _mm_mul_ps(b, _mm_loadu_ps(ny + o))),
+						_mm_add_ps(_mm_mul_ps(c, _mm_loadu_ps(nz + o)), d));
+					if (half == 0) {
+						outsideLo = _mm_or_ps(outsideLo, _mm_cmplt_ps(dp, zero));
+						partialLo = _mm_or_ps(partialLo, _mm_cmplt_ps(dn, zero));
+					}
+					else {
+						outsideHi = _mm_or_ps(outsideHi, _mm_cmplt_ps(dp, zero));
+						partialHi = _mm_or_ps(partialHi, _mm_cmplt_ps(dn, zero));
+					}
+				}
+			}
+			int outside = _mm_movemask_ps(outsideLo) | (_mm_movemask_ps(outsideHi) << 4);
+			int partial = _mm_movemask_ps(partialLo) | (_mm_movemask_ps(partialHi) << 4);
+			for (int lane = 0; lane < 8 && i + lane < first + n; lane++) {
+				int bit = 1 << lane;
+				out[i + lane - first] = (outside & bit) ? NOLOAD : ((partial & bit) ? TOCHECK : LOAD);
+			}
+		}
+#else
+		for (int i = first; i < first + n; i++) {
+			inView result = LOAD;
+			for (int p = 0; p < 6 && result != NOLOAD; p++) {
+				const glm::vec4& pl = f.planes[p];
+				glm::vec3 pv((pl.x > 0) ? maxX[i] : minX[i], (pl.y > 0) ? maxY[i] : minY[i], (pl.z > 0) ? maxZ[i] : minZ[i]);
+				glm::vec3 nv((pl.x > 0) ? minX[i] : maxX[i], (pl.y > 0) ? minY[i] : maxY[i], (pl.z > 0) ? minZ[i] : maxZ[i]);
+				if (glm::dot(glm::vec3(pl), pv) + pl.w < 0) {
+					result = NOLOAD;
+				}
+				else if (glm::dot(glm::vec3(pl), nv) + pl.w < 0) {
+					result = TOCHECK;
+				}
+			}
+			out[i - first] = result;
+		}
+#endif
+	}
+};
+
+class FrustumCuller {
+public:
+	/*
+		Two levels: regions of REGION_CHUNKS^3 chunks are classified first.
+		Chunks in a region that is fully outside or fully inside inherit
+		its state; only straddling regions test their chunks. Chunk boxes
+		are stored region by region, each region's run padded to a multiple
+		of 8 so it can be classified on its own.
+	*/
+	std::vector<Chunk*> visible;
+	int regionsTested;
+	int chunksTested;
+
+	FrustumCuller(const VoxelGrid* grid) {
+		int regionsPerSide = (grid->chunksPerSide + REGION_CHUNKS - 1) / REGION_CHUNKS;
+		float chunkExtent = (float)CHUNK_SIZE;
+		for (int rx = 0; rx < regionsPerSide; rx++) {
+			for (int ry = 0; ry < regionsPerSide; ry++) {
+				for (int rz = 0; rz < regionsPerSide; rz++) {
+					glm::ivec3 lo = glm::ivec3(rx, ry, rz) * REGION_CHUNKS;
+					glm::ivec3 hi = glm::min(lo + REGION_CHUNKS, glm::ivec3(grid->chunksPerSide));
+					regionStart.push_back((int)chunkOrder.size());
+					for (int cx = lo.x; cx < hi.x; cx++) {
+						for (int cy = lo.y; cy < hi.y; cy++) {
+							for (int cz = lo.z; cz < hi.z; cz++) {
+								Chunk* chunk = grid->chunkAt(cx, cy, cz);
+								glm::vec3 o = grid->chunkOrigin(chunk);
+								chunkOrder.push_back(chunk);
+								chunkBoxes.add(o, o + chunkExtent);
+							}
+						}
+					}
+					chunkBoxes.pad();
+					chunkOrder.resize(chunkBoxes.count, NULL);
+					glm::vec3 o = grid->origin + glm::vec3(lo * CHUNK_SIZE);
+					regionBoxes.add(o, o + glm::vec3((hi - lo) * CHUNK_SIZE));
+				}
+			}
+		}
+		regionStart.push_back((int)chunkOrder.size());
+		regionState.resize(regionBoxes.count);
+		chunkState.resize(chunkBoxes.count);
+		// so cull() never has to grow it
+		visible.reserve(chunkOrder.size());
+		regionsTested = 0;
+		chunksTested = 0;
+	}
+
+	void cull(const glm::mat4& viewProj) {
+		Frustum f(viewProj);
+		visible.clear();
+		regionsTested = regionBoxes.count;
+		chunksTested = 0;
+		regionBoxes.classify(f, 0, regionBoxes.count, regionState.data());
+
+		for (int r = 0; r < regionBoxes.count; r++) {
+			int first = regionStart[r];
+			int n = regionStart[r + 1] - first;
+			if (regionState[r] == TOCHECK) {
+				chunkBoxes.classify(f, first, n, &chunkState[first]);
+				chunksTested += n;
+			}
+			for (int i = first; i < first + n; i++) {
+				Chunk* chunk = chunkOrder[i];
+				if (chunk == NULL) {
+					continue;
+				}
+				chunk->view = (regionState[r] == TOCHECK) ? chunkState[i] : regionState[r];
+				if (chunk->view != NOLOAD && chunk->vertexCount > 0) {
+					visible.push_back(chunk);
+				}
+			}
+		}
+	}
+
+private:
+	BoxList regionBoxes;
+	BoxList chunkBoxes;
+	std::vector<int> regionStart;
+	std::vector<Chunk*> chunkOrder;
+	std::vector<inView> regionState;
+	std::vector<inView> chunkState;
+};
+
+#endif
@@ -0,0 +1,578 @@
+#ifndef GPU_UPLOAD_H
+#define GPU_UPLOAD_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include "chunk.h"
+#include "memory.h"
+#include "mesher.h"
+#include "tracer.h"
+
+#ifndef GL_MAP_PERSISTENT_BIT
+// GL 4.4 / ARB_buffer_storage, which the 3.3 core glad loader leaves out
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+#endif
+
+// vertices per shared vertex buffer; bigger meshes get a page of their own
+const int ARENA_PAGE_VERTICES = 4 * 1024 * 1024;
+// default upload budget per frame
+const int UPLOAD_BYTES_PER_FRAME = 4 * 1024 * 1024;
+const double UPLOAD_MS_PER_FRAME = 2.0;
+// frames the GPU may still be reading staging memory from; one ring segment each
+const int STAGING_FRAMES = 3;
+
+class ArenaRange {
+public:
+	int first;
+	int count;
+};
+
+class ArenaFreeList {
+public:
+	/*
+		The free vertex ranges of one page, sorted by first, neighbours
+		always merged. Plain bookkeeping with no GL, so it can be checked
+		headless (arena_check.cpp).
+	*/
+	std::vector<ArenaRange> ranges;
+
+	void reset(int capacity) {
+		ranges.clear();
+		ranges.push_back({ 0, capacity });
+	}
+
+	bool take(int count, int* first) {
+		// first fit
+		for (size_t i = 0; i < ranges.size(); i++) {
+			if (ranges[i].count < count) {
+				continue;
+			}
+			*first = ranges[i].first;
+			ranges[i].first += count;
+			ranges[i].count -= count;
+			if (ranges[i].count == 0) {
+				ranges.erase(ranges.begin() + i);
+			}
+			return true;
+		}
+		return false;
+	}
+
+	void give(int first, int count) {
+		auto it = std::lower_bound(ranges.begin(), ranges.end(), first, [](const ArenaRange& r, int f) { return r.first < f; });
+		it = ranges.insert(it, { first, count });
+		// merge with the next range, then the previous one
+		if (it + 1 != ranges.end() && it->first + it->count == (it + 1)->first) {
+			it->count += (it + 1)->count;
+			ranges.erase(it + 1);
+		}
+		if (it != ranges.begin() && (it - 1)->first + (it - 1)->count == it->first) {
+			(it - 1)->count += it->count;
+			ranges.erase(it);
+		}
+	}
+};
+
+class ArenaPage {
+public:
+	unsigned int VAO;
+	unsigned int VBO;
+	int capacity;
+	ArenaFreeList freeList;
+};
+
+class VertexArena {
+public:
+	/*
+		Chunk meshes live in a few large vertex buffers instead of one
+		VBO each. A mesh is placed as its page's VAO and VBO plus the first
+		vertex of its range, and is drawn with glDrawArrays(first, count). Chunks
+		that share a page share a VAO, so consecutive draws mostly skip the
+		rebind. Ranges are handed out first-fit from a sorted free list and
+		merged with their neighbours when freed.
+		A range can be reused as soon as it is freed: GL orders the copy
+		that overwrites it after the draws already issued from it.
+	*/
+	std::vector<ArenaPage*> pages;
+	int usedVertices;
+
+	VertexArena() {
+		usedVertices = 0;
+	}
+
+	ArenaPage* allocate(int count, int* first) {
+		for (auto page : pages) {
+			if (take(page, count, first)) {
+				return page;
+			}
+		}
+		ArenaPage* page = addPage(std::max(count, ARENA_PAGE_VERTICES));
+		take(page, count, first);
+		return page;
+	}
+
+	void free(unsigned int VBO, int first, int count) {
+		for (auto page : pages) {
+			if (page->VBO != VBO) {
+				continue;
+			}
+			page->freeList.give(first, count);
+			usedVertices -= count;
+			return;
+		}
+	}
+
+	void destroy() {
+		for (auto page : pages) {
+			glDeleteVertexArrays(1, &page->VAO);
+			glDeleteBuffers(1, &page->VBO);
+			MemoryTracker::get().release(MEM_GPU, (int64_t)page->capacity * sizeof(packedVertex));
+			delete(page);
+		}
+		pages.clear();
+		usedVertices = 0;
+	}
+
+	int64_t capacityBytes() const {
+		int64_t bytes = 0;
+		for (auto page : pages) {
+			bytes += (int64_t)page->capacity * sizeof(packedVertex);
+		}
+		return bytes;
+	}
+
+private:
+	bool take(ArenaPage* page, int count, int* first) {
+		if (!page->freeList.take(count, first)) {
+			return false;
+		}
+		usedVertices += count;
+		return true;
+	}
+
+	ArenaPage* addPage(int capacity) {
+		TRACE_ZONE("arena page");
+		ArenaPage* page = new ArenaPage();
+		page->capacity = capacity;
+		page->freeList.reset(capacity);
+		glGenVertexArrays(1, &page->VAO);
+		glGenBuffers(1, &page->VBO);
+		glBindVertexArray(page->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, page->VBO);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)capacity * sizeof(packedVertex), NULL, GL_STATIC_DRAW);
+		glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(packedVertex), (void*)0);
+		glEnableVertexAttribArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		MemoryTracker::get().add(MEM_GPU, (int64_t)capacity * sizeof(packedVertex));
+		pages.push_back(page);
+		return page;
+	}
+};
+
+class StagingRing {
+public:
+	/*
+		One persistently mapped buffer cut into STAGING_FRAMES segments.
+		Each frame writes into the next segment and fences it at the end.
+		A segment comes round again STAGING_FRAMES frames later. By then
+		its fence has nearly always signalled, so the CPU only waits when
+		the GPU has fallen that far behind.
+	*/
+	int segmentBytes;
+	// frames that had to wait on a fence
+	long long stalls;
+
+	StagingRing() {
+		buffer = 0;
+		mapped = NULL;
+		segmentBytes = 0;
+		segment = 0;
+		used = 0;
+		stalls = 0;
+		for (int i = 0; i < STAGING_FRAMES; i++) {
+			fences[i] = 0;
+		}
+	}
+
+	bool init(PFNGLBUFFERSTORAGEPROC bufferStorage, int bytes) {
+		segmentBytes = bytes;
+		GLsizeiptr size = (GLsizeiptr)bytes * STAGING_FRAMES;
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		bufferStorage(GL_COPY_READ_BUFFER, size, NULL, flags);
+		mapped = (char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, flags);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		if (mapped == NULL) {
+			glDeleteBuffers(1, &buffer);
+			buffer = 0;
+			return false;
+		}
+		MemoryTracker::get().add(MEM_GPU, size);
+		return true;
+	}
+
+	bool ready() const {
+		return mapped != NULL;
+	}
+
+	unsigned int handle() const {
+		return buffer;
+	}
+
+	void beginFrame() {
+		segment = (segment + 1) % STAGING_FRAMES;
+		used = 0;
+		GLsync fence = fences[segment];
+		if (fence == 0) {
+			return;
+		}
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			TRACE_ZONE("staging stall");
+			stalls++;
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+			}
+		}
+		glDeleteSync(fence);
+		fences[segment] = 0;
+	}
+
+	bool empty() const {
+		return used == 0;
+	}
+
+	char* reserve(int bytes, GLintptr* offset) {
+		// NULL when this frame's segment is full
+		if (used + bytes > segmentBytes) {
+			return NULL;
+		}
+		*offset = (GLintptr)segment * segmentBytes + used;
+		used += bytes;
+		return mapped + *offset;
+	}
+
+	void endFrame() {
+		if (used > 0) {
+			fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+	}
+
+	void destroy() {
+		for (int i = 0; i < STAGING_FRAMES; i++) {
+			if (fences[i] != 0) {
+				glDeleteSync(fences[i]);
+				fences[i] = 0;
+			}
+		}
+		if (buffer != 0) {
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glDeleteBuffers(1, &buffer);
+			MemoryTracker::get().release(MEM_GPU, (int64_t)segmentBytes * STAGING_FRAMES);
+			buffer = 0;
+			mapped = NULL;
+		}
+	}
+
+private:
+	unsigned int buffer;
+	char* mapped;
+	GLsync fences[STAGING_FRAMES];
+	int segment;
+	int used;
+};
+
+class MeshPlacement {
+public:
+	unsigned int VAO;
+	unsigned int VBO;
+	int first;
+	int count;
+};
+
+class PendingUpload {
+public:
+	// NULL once cancelled
+	const Chunk* chunk;
+	std::vector<packedVertex> vertices;
+};
+
+class UploadScheduler {
+public:
+	/*
+		GPU upload scheduling
+		---------------------
+		submit() -> queue -> flush(), once per frame -> arena
+		---------------------
+		Meshes are queued and uploaded in submission order. Each frame's
+		flush() stops once the frame has used bytesPerFrame or msPerFrame.
+		It always uploads at least one mesh, so a mesh bigger than the
+		budget still goes through. The rest waits for the next frame, so a
+		burst of meshes from streaming or a big dig spreads over several
+		frames instead of stalling one.
+		With ARB_buffer_storage, vertices are copied into this frame's
+		segment of the staging ring, then into the arena with
+		glCopyBufferSubData. The driver never has to copy or orphan the
+		data itself. Without it, glBufferSubData writes into the arena
+		directly, under the same budget.
+		A chunk keeps drawing its old mesh until the new one has landed.
+		Placements are looked up by chunk pointer and the pointer is
+		never followed, so this can all live on the render thread while
+		the simulation owns the chunks.
+		---------------------
+		submit() takes the vertices over. The caller is expected to have
+		counted their capacity under MEM_MESHES; it is released here once
+		the upload is done.
+	*/
+	int bytesPerFrame;
+	double msPerFrame;
+	// the last flush()
+	int frameUploads;
+	int frameBytes;
+	double frameMs;
+	// since init()
+	long long totalUploads;
+	long long totalBytes;
+	long long framesOverBudget;
+	double worstMs;
+
+	UploadScheduler() {
+		bytesPerFrame = UPLOAD_BYTES_PER_FRAME;
+		msPerFrame = UPLOAD_MS_PER_FRAME;
+		frameUploads = 0;
+		frameBytes = 0;
+		frameMs = 0.0;
+		totalUploads = 0;
+		totalBytes = 0;
+		framesOverBudget = 0;
+		worstMs = 0.0;
+		head = 0;
+	}
+
+	void init(GLADloadproc load) {
+		// the ring has to be created after the budget is final
+		PFNGLBUFFERSTORAGEPROC bufferStorage = NULL;
+		if (hasExtension("GL_ARB_buffer_storage")) {
+			bufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+		}
+		if (bufferStorage != NULL && staging.init(bufferStorage, bytesPerFrame)) {
+			std::cout << "Uploading through a " << STAGING_FRAMES << " x " << bytesPerFrame / (1024 * 1024) << " MB persistent staging ring" << std::endl;
+		}
+		else {
+			std::cout << "No ARB_buffer_storage, uploading with glBufferSubData" << std::endl;
+		}
+		pending.reserve(256);
+		queuedAt.reserve(256);
+	}
+
+	void submit(const Chunk* chunk, std::vector<packedVertex>& vertices) {
+		cancel(chunk);
+		queuedAt[chunk] = pending.size();
+		pending.emplace_back();
+		pending.back().chunk = chunk;
+		pending.back().vertices.swap(vertices);
+	}
+
+	void cancel(const Chunk* chunk) {
+		auto it = queuedAt.find(chunk);
+		if (it != queuedAt.end()) {
+			PendingUpload& u = pending[it->second];
+			dropVertices(u);
+			u.chunk = NULL;
+			queuedAt.erase(it);
+		}
+	}
+
+	void release(const Chunk* chunk) {
+		// before the chunk is deleted or its mesh thrown away
+		cancel(chunk);
+		unplace(chunk);
+	}
+
+	const MeshPlacement* find(const Chunk* chunk) const {
+		auto it = placed.find(chunk);
+		return (it == placed.end()) ? NULL : &it->second;
+	}
+
+	int queued() const {
+		return (int)(pending.size() - head);
+	}
+
+	void flush() {
+		flush(false);
+	}
+
+	void drain() {
+		// everything queued, ignoring the budget; for loading screens and shutdown
+		flush(true);
+	}
+
+	void destroy() {
+		for (size_t i = head; i < pending.size(); i++) {
+			dropVertices(pending[i]);
+		}
+		pending.clear();
+		head = 0;
+		queuedAt.clear();
+		placed.clear();
+		arena.destroy();
+		staging.destroy();
+	}
+
+	void report(std::ostream& os) const {
+		os << "uploads: " << totalUploads << " meshes, " << std::fixed << std::setprecision(2) << totalBytes / (1024.0 * 1024.0)
+			<< " MB, worst frame " << worstMs << " ms, " << framesOverBudget << " frames hit the budget, "
+			<< staging.stalls << " staging stalls; arena " << arena.pages.size() << " pages, "
+			<< arena.usedVertices * sizeof(packedVertex) / (1024.0 * 1024.0) << "/" << arena.capacityBytes() / (1024.0 * 1024.0) << " MB used" << std::endl;
+		os.unsetf(std::ios::floatfield);
+	}
+
+private:
+	VertexArena arena;
+	StagingRing staging;
+	std::vector<PendingUpload> pending;
+	// pending[0, head) are done
+	size_t head;
+	// where each chunk's queued mesh is in pending; a chunk has at most one
+	std::unordered_map<const Chunk*, size_t> queuedAt;
+	std::unordered_map<const Chunk*, MeshPlacement> placed;
+
+	static bool hasExtension(const char* name) {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++) {
+			const char* ext = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (ext != NULL && strcmp(ext, name) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static double msSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void unplace(const Chunk* chunk) {
+		auto it = placed.find(chunk);
+		if (it != placed.end()) {
+			arena.free(it->second.VBO, it->second.first, it->second.count);
+			placed.erase(it);
+		}
+	}
+
+	void dropVertices(PendingUpload& u) {
+		MemoryTracker::get().release(MEM_MESHES, u.vertices.capacity() * sizeof(packedVertex));
+		std::vector<packedVertex>().swap(u.vertices);
+	}
+
+	void flush(bool everything) {
+		frameUploads = 0;
+		frameBytes = 0;
+		frameMs = 0.0;
+		if (staging.ready()) {
+			staging.beginFrame();
+		}
+		if (head == pending.size()) {
+			if (staging.ready()) {
+				staging.endFrame();
+			}
+			return;
+		}
+		TRACE_ZONE("upload chunks");
+		auto start = std::chrono::steady_clock::now();
+		while (head < pending.size()) {
+			PendingUpload& u = pending[head];
+			if (u.chunk == NULL) {
+				head++;
+				continue;
+			}
+			int bytes = (int)(u.vertices.size() * sizeof(packedVertex));
+			bool overBudget = frameBytes + bytes > bytesPerFrame || msSince(start) >= msPerFrame;
+			if (!everything && frameUploads > 0 && overBudget) {
+				framesOverBudget++;
+				break;
+			}
+			if (!upload(u)) {
+				// staging segment full; the next frame has a fresh one
+				if (!everything) {
+					framesOverBudget++;
+					break;
+				}
+				staging.endFrame();
+				staging.beginFrame();
+				continue;
+			}
+			queuedAt.erase(u.chunk);
+			dropVertices(u);
+			head++;
+			frameUploads++;
+			frameBytes += bytes;
+		}
+		if (staging.ready()) {
+			staging.endFrame();
+		}
+		if (head == pending.size() || (head > 64 && head * 2 > pending.size())) {
+			pending.erase(pending.begin(), pending.begin() + head);
+			for (auto& entry : queuedAt) {
+				entry.second -= head;
+			}
+			head = 0;
+		}
+		frameMs = msSince(start);
+		worstMs = std::max(worstMs, frameMs);
+		totalUploads += frameUploads;
+		totalBytes += frameBytes;
+	}
+
+	bool upload(PendingUpload& u) {
+		const Chunk* chunk = u.chunk;
+		int count = (int)u.vertices.size();
+		GLsizeiptr bytes = (GLsizeiptr)count * sizeof(packedVertex);
+		if (count == 0) {
+			unplace(chunk);
+			return true;
+		}
+		char* dst = NULL;
+		GLintptr src = 0;
+		if (staging.ready()) {
+			dst = staging.reserve((int)bytes, &src);
+			// a mesh too big for even an empty segment takes the slow path
+			if (dst == NULL && !staging.empty()) {
+				return false;
+			}
+		}
+		int first = 0;
+		ArenaPage* page = arena.allocate(count, &first);
+		GLintptr offset = (GLintptr)first * sizeof(packedVertex);
+		if (dst != NULL) {
+			memcpy(dst, u.vertices.data(), bytes);
+			glBindBuffer(GL_COPY_READ_BUFFER, staging.handle());
+			glBindBuffer(GL_COPY_WRITE_BUFFER, page->VBO);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src, offset, bytes);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+		else {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, page->VBO);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, u.vertices.data());
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		// the old range is still drawn from until this point
+		unplace(chunk);
+		placed[chunk] = { page->VAO, page->VBO, first, count };
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "tracer.h"
+
+class Job {
+public:
+	std::function<void()> fn;
+	// unmet dependencies, plus one until the job is submitted
+	std::atomic<int> pending;
+	// one for the owner, one while the job system still needs it
+	std::atomic<int> refs;
+	std::atomic<bool> done;
+	std::mutex lock;
+	std::vector<Job*> dependents;
+
+	Job(std::function<void()> f) : fn(f), pending(1), refs(2), done(false) {}
+};
+
+class JobSystem {
+public:
+	/*
+		Work-stealing job system
+		---------------------
+		Every worker (and the main thread, as worker 0) owns a deque. Jobs
+		submitted from a thread go to the back of its deque and the owner
+		pops from the back; idle threads steal from the front of someone
+		else's deque. Jobs queued with runOnRenderThread() only run from
+		runPending(), which the thread holding the GL context (the render
+		thread) calls once per frame - that is where GL calls belong.
+		---------------------
+	*/
+	JobSystem(int numThreads = 0) {
+		if (numThreads <= 0) {
+			numThreads = (int)std::thread::hardware_concurrency();
+		}
+		numThreads = (numThreads < 1) ? 1 : numThreads;
+		running = true;
+		queued = 0;
+		for (int i = 0; i < numThreads; i++) {
+			queues.push_back(new WorkQueue());
+		}
+		workerIndex() = 0;
+		TRACE_THREAD("main");
+		// the calling thread is worker 0, so numThreads - 1 extra threads
+		for (int i = 1; i < numThreads; i++) {
+			threads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+		}
+	}
+
+	~JobSystem() {
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+			running = false;
+		}
+		wake.notify_all();
+		for (auto& t : threads) {
+			t.join();
+		}
+		// jobs that never ran still hold both references, and nobody can
+		// wait on them any more, so they go outright - along with the jobs
+		// that were waiting on them. Handles to them are invalid from here.
+		std::vector<Job*> orphans;
+		std::unordered_set<Job*> seen;
+		for (auto q : queues) {
+			for (auto job : q->jobs) {
+				orphans.push_back(job);
+				seen.insert(job);
+			}
+			delete(q);
+		}
+		for (size_t i = 0; i < orphans.size(); i++) {
+			for (auto next : orphans[i]->dependents) {
+				if (seen.insert(next).second) {
+					orphans.push_back(next);
+				}
+			}
+		}
+		for (auto job : orphans) {
+			delete(job);
+		}
+	}
+
+	int numWorkers() const {
+		return (int)queues.size();
+	}
+
+	Job* createJob(std::function<void()> fn) {
+		return new Job(fn);
+	}
+
+	void addDependency(Job* job, Job* before) {
+		// job will not start until before has finished; call before submit(job)
+		std::lock_guard<std::mutex> guard(before->lock);
+		if (before->done) {
+			return;
+		}
+		job->pending++;
+		before->dependents.push_back(job);
+	}
+
+	void submit(Job* job) {
+		if (--job->pending == 0) {
+			enqueue(job);
+		}
+	}
+
+	Job* run(std::function<void()> fn) {
+		Job* job = createJob(fn);
+		submit(job);
+		return job;
+	}
+
+	void launch(std::function<void()> fn) {
+		// fire and forget
+		release(run(fn));
+	}
+
+	void wait(Job* job) {
+		// help out with other work instead of blocking
+		while (!job->done) {
+			if (!runOne()) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	void release(Job* job) {
+		if (--job->refs == 0) {
+			delete(job);
+		}
+	}
+
+	void finish(Job* job) {
+		wait(job);
+		release(job);
+	}
+
+	template <typename F>
+	void parallelFor(int begin, int end, int grain, F fn) {
+		// fn(from, to) is called on disjoint [from, to) ranges covering [begin, end)
+		if (end <= begin) {
+			return;
+		}
+		grain = (grain < 1) ? 1 : grain;
+		if (end - begin <= grain || numWorkers() == 1) {
+			fn(begin, end);
+			return;
+		}
+		std::vector<Job*> batch;
+		for (int from = begin; from < end; from += grain) {
+			int to = (from + grain < end) ? from + grain : end;
+			batch.push_back(run([=]() { fn(from, to); }));
+		}
+		for (auto job : batch) {
+			finish(job);
+		}
+	}
+
+	template <typename F>
+	void parallelForEach(int count, F fn) {
+		// fn(i) for every i in [0, count), split into a few batches per worker
+		int grain = count / (numWorkers() * 4);
+		parallelFor(0, count, grain, [&fn](int from, int to) {
+			for (int i = from; i < to; i++) {
+				fn(i);
+			}
+		});
+	}
+
+	bool runOne() {
+		// run one queued job if there is any, for threads waiting on results
+		int self = workerIndex();
+		self = (self < 0) ? 0 : self;
+		if (queued == 0) {
+			return false;
+		}
+		Job* job = pop(self);
+		if (job == NULL) {
+			job = steal(self);
+		}
+		if (job == NULL) {
+			return false;
+		}
+		queued--;
+		execute(job);
+		return true;
+	}
+
+	void runOnRenderThread(std::function<void()> fn) {
+		std::lock_guard<std::mutex> guard(renderLock);
+		renderJobs.push_back(fn);
+	}
+
+	int runPending() {
+		// render thread only: drain the jobs queued with runOnRenderThread()
+		{
+			// most frames have none, and those should not allocate
+			std::lock_guard<std::mutex> guard(renderLock);
+			if (renderJobs.empty()) {
+				return 0;
+			}
+		}
+		std::deque<std::function<void()>> jobs;
+		{
+			std::lock_guard<std::mutex> guard(renderLock);
+			jobs.swap(renderJobs);
+		}
+		for (auto& fn : jobs) {
+			fn();
+		}
+		return (int)jobs.size();
+	}
+
+private:
+	class WorkQueue {
+	public:
+		std::mutex lock;
+		std::deque<Job*> jobs;
+	};
+
+	std::vector<WorkQueue*> queues;
+	std::vector<std::thread> threads;
+	std::atomic<bool> running;
+	std::atomic<int> queued;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::mutex renderLock;
+	std::deque<std::function<void()>> renderJobs;
+
+	static int& workerIndex() {
+		static thread_local int index = -1;
+		return index;
+	}
+
+	void enqueue(Job* job) {
+		int self = workerIndex();
+		WorkQueue* q = queues[(self < 0) ? 0 : self];
+		{
+			std::lock_guard<std::mutex> guard(q->lock);
+			q->jobs.push_back(job);
+		}
+		queued++;
+		wake.notify_one();
+	}
+
+	Job* pop(int self) {
+		WorkQueue* q = queues[self];
+		std::lock_guard<std::mutex> guard(q->lock);
+		if (q->jobs.empty()) {
+			return NULL;
+		}
+		Job* job = q->jobs.back();
+		q->jobs.pop_back();
+		return job;
+	}
+
+	Job* steal(int self) {
+		static thread_local std::minstd_rand rng(std::hash<std::thread::id>()(std::this_thread::get_id()));
+		int n = (int)queues.size();
+		int start = (int)(rng() % n);
+		for (int i = 0; i < n; i++) {
+			int victim = (start + i) % n;
+			if (victim == self) {
+				continue;
+			}
+			WorkQueue* q = queues[victim];
+			std::lock_guard<std::mutex> guard(q->lock);
+			if (!q->jobs.empty()) {
+				Job* job = q->jobs.front();
+				q->jobs.pop_front();
+				return job;
+			}
+		}
+		return NULL;
+	}
+
+	void execute(Job* job) {
+		if (job->fn) {
+			job->fn();
+		}
+		std::vector<Job*> ready;
+		{
+			std::lock_guard<std::mutex> guard(job->lock);
+			job->done = true;
+			ready.swap(job->dependents);
+		}
+		for (auto next : ready) {
+			submit(next);
+		}
+		release(job);
+	}
+
+	void workerLoop(int index) {
+		workerIndex() = index;
+		TRACE_THREAD("worker " + std::to_string(index));
+		while (running) {
+			if (runOne()) {
+				continue;
+			}
+			std::unique_lock<std::mutex> guard(sleepLock);
+			wake.wait_for(guard, std::chrono::milliseconds(1), [this]() {
+				return queued > 0 || !running;
+			});
+		}
+	}
+};
+
+#endif
@@ -2,11 +2,16 @@
 #define LSYSTEM_H
 
 #include "string_util.h"
+#include <chrono>
 #include <map>
 #include <random>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/ext.hpp>
+#include <glm/gtx/string_cast.hpp>
 #include "cube.h"
+#include "jobs.h"
+#include "memory.h"
+#include "tracer.h"
 
 class LSystem {
 public:
@@ -14,12 +19,37 @@ public:
 	int numCubes;
 	std::string fileName;
 	std::vector<Cube*> cubes;
+	// per-symbol progress output, too slow to keep on for big grammars
+	bool verbose;
+	// stage times of the last parse, in ms
+	double parseMs;
+	double rewriteMs;
+	double carveMs;
 
 	LSystem(std::string fName) {
 		fileName = fName;
+		verbose = true;
+		parseMs = 0.0;
+		rewriteMs = 0.0;
+		carveMs = 0.0;
+		matrix = NULL;
+		matrixSize = 0;
+	}
+
+	// owns the matrix and its memory accounting, so it can't be copied
+	LSystem(const LSystem&) = delete;
+	LSystem& operator=(const LSystem&) = delete;
+
+	~LSystem() {
+		for (auto& s : strings) {
+			MemoryTracker::get().release(MEM_GRAMMAR, s.capacity());
+		}
+		freeMatrix();
 	}
 
 	void setupMatrix() {
+		// a second call starts over with a fresh matrix
+		freeMatrix();
 		matrix = (char***)calloc(numCubes, sizeof(char**));
 		if (matrix == NULL) {
 			std::cerr << "Out of allocatable memory" << std::endl;
@@ -39,12 +69,22 @@ public:
 				}
 			}
 		}
+		matrixSize = numCubes;
+		MemoryTracker::get().add(MEM_VOXELS, matrixBytes());
+	}
+
+	int64_t matrixBytes() const {
+		int64_t n = numCubes;
+		return n * sizeof(char**) + n * n * sizeof(char*) + n * n * n;
 	}
 
-	std::vector<Cube *> writeCubes() {
+	std::vector<Cube *> writeCubes(JobSystem* jobs = NULL) {
+		TRACE_ZONE("LSystem::writeCubes");
 		int mid = numCubes / 2;
+		std::vector<std::vector<Cube*>> slabs(numCubes);
 
-		for (int i = 0; i < numCubes; i++) {
+		auto writeSlab = [&](int i) {
+			TRACE_ZONE("writeCubes slab");
 			for (int j = 0; j < numCubes; j++) {
 				for (int k = 0; k < numCubes; k++) {
 					if (matrix[i][j][k] == 0) {
@@ -52,12 +92,27 @@ public:
 						float y = mid - j;
 						float z = mid - k;
 						Cube* newCube = new Cube(glm::vec3(x, y, z));
-						cubes.push_back(newCube);
+						slabs[i].push_back(newCube);
 					}
 				}
 			}
+		};
+
+		if (jobs != NULL) {
+			jobs->parallelForEach(numCubes, writeSlab);
+		}
+		else {
+			for (int i = 0; i < numCubes; i++) {
+				writeSlab(i);
+			}
 		}
 
+		// keep the serial i, j, k order
+		size_t before = cubes.size();
+		for (auto& slab : slabs) {
+			cubes.insert(cubes.end(), slab.begin(), slab.end());
+		}
+		MemoryTracker::get().add(MEM_VOXELS, (cubes.size() - before) * (sizeof(Cube) + sizeof(Cube*)));
 		return cubes;
 	}
 
@@ -65,9 +120,12 @@ public:
 		for (auto cube : cubes) {
 			delete(cube);
 		}
+		MemoryTracker::get().release(MEM_VOXELS, cubes.size() * (sizeof(Cube) + sizeof(Cube*)));
+		cubes.clear();
 	}
 
 	void parse(std::istream& istr) {
+		TRACE_ZONE("LSystem::parse");
 		/*
 			Format of input files
 			---------------------
@@ -126,16 +184,28 @@ public:
 
 		setupMatrix();
 		strings.push_back(inAxiom);
+		MemoryTracker::get().add(MEM_GRAMMAR, strings.back().capacity());
+		auto parsed = std::chrono::steady_clock::now();
+		parseMs = std::chrono::duration<double, std::milli>(parsed - parseStart).count();
+		MemoryTracker::get().stage("parse");
 
 		for (int i = 0; i < inIters; i++) {
 			iterate();
-			std::cout << strings.back() << std::endl;
+			if (verbose) {
+				std::cout << strings.back() << std::endl;
+			}
 		}
+		auto rewritten = std::chrono::steady_clock::now();
+		rewriteMs = std::chrono::duration<double, std::milli>(rewritten - parsed).count();
+		MemoryTracker::get().stage("rewrite");
 
 		drawGeometry(strings.back());
+		carveMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - rewritten).count();
+		MemoryTracker::get().stage("carve");
 	}
 
 	void parseString(std::string str) {
+		parseStart = std::chrono::steady_clock::now();
 		std::stringstream ss(str);
 
 		ss = preprocessStream(ss);
@@ -143,6 +213,7 @@ public:
 	}
 
 	void parseFile() {
+		parseStart = std::chrono::steady_clock::now();
 		std::cout << "0" << std::endl;
 		std::ifstream file(fileName);
 		std::cout << "1" << std::endl;
@@ -157,6 +228,7 @@ public:
 	}
 
 	unsigned int iterate() {
+		TRACE_ZONE("LSystem::iterate");
 		if (strings.empty()) {
 			return 0;
 		}
@@ -164,6 +236,7 @@ public:
 		std::string newString = applyRules(strings.back());
 
 		strings.push_back(newString);
+		MemoryTracker::get().add(MEM_GRAMMAR, strings.back().capacity());
 		return strings.size();
 	}
 
@@ -209,6 +282,7 @@ public:
 	}
 
 	void drawGeometry(std::string str) {
+		TRACE_ZONE("LSystem::drawGeometry");
 		glm::vec3 start = glm::vec3(numCubes / 2, numCubes / 2, 0);
 		glm::vec3 advance = glm::vec3(0, 0, 1);
 		glm::vec3 curr = start;
@@ -220,14 +294,17 @@ public:
 			int z = curr.z;
 			switch (c) {
 			case 'f':
-				if (x > max || y > max || z > max) {
+				// the walk runs past the end of the grid once the string is longer than it
+				if (x >= max || y >= max || z >= max) {
 					break;
 				}
 				matrix[x][y][z] = 2;
 				break;
 			}
 			curr = curr + advance;
-			std::cout << "curr: " << glm::to_string(curr) << std::endl;
+			if (verbose) {
+				std::cout << "curr: " << glm::to_string(curr) << std::endl;
+			}
 		}
 	}
 
@@ -236,6 +313,26 @@ private:
 	std::multimap<char, float> weights;
 	std::mt19937 rng;
 	std::vector<std::string> strings;
+	std::chrono::steady_clock::time_point parseStart;
+	// numCubes when the matrix was allocated
+	int matrixSize;
+
+	void freeMatrix() {
+		if (matrix == NULL) {
+			return;
+		}
+		for (int i = 0; i < matrixSize; i++) {
+			for (int j = 0; j < matrixSize; j++) {
+				free(matrix[i][j]);
+			}
+			free(matrix[i]);
+		}
+		free(matrix);
+		int64_t n = matrixSize;
+		MemoryTracker::get().release(MEM_VOXELS, n * sizeof(char**) + n * n * sizeof(char*) + n * n * n);
+		matrix = NULL;
+		matrixSize = 0;
+	}
 };
 
 #endif LSYSTEM_H
\ No newline at end of file
@@ -1,11 +1,11 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include "Shader.h"
 #include "Camera.h"
 #include "lsystem.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
 #define GLM_SWIZZLE
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -13,6 +13,27 @@
 #include <vector>
 #include "cube.h"
 #include "lsystem.h"
+#include "chunk.h"
+#include "mesher.h"
+#include "jobs.h"
+#include "frustum.h"
+#include "occlusion.h"
+#include "pvs.h"
+#include "raycast.h"
+#include "cpu_renderer.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "tracer.h"
+#include "memory.h"
+#include "flythrough.h"
+#include "stream.h"
+#include "gpu_upload.h"
+#include "render_queue.h"
+#define ALLOC_TRACKER_IMPLEMENTATION
+#include "alloc_tracker.h"
+#include "frame_loop.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
 
 float mixVal = 0.2;
 glm::mat4 model = glm::mat4(1.0f);
@@ -73,10 +94,40 @@ float vertices[] = {
     -0.5f,  0.5f, -0.5f,  0.0f, 1.0f 
 };
 
+const UniformHandle MODEL_UNIFORM("model");
+const UniformHandle CHUNK_ORIGIN_UNIFORM("chunkOrigin");
+const UniformHandle MIX_UNIFORM("mixVal");
+
 int numCubes = 11;
 Camera cam = Camera(glm::vec3(0.0f, 0.0f, numCubes * 2));
 int mid = numCubes / 2;
+// fixed once the grammar has run: digging edits the voxel grid, which only chunk mode draws
 std::vector<Cube *> cubePositions; 
+// bytes currently in the instance buffer
+size_t instanceBytes = 0;
+VoxelGrid *grid = NULL;
+// set with --stream; the grammar's grid then stays empty
+StreamingWorld *world = NULL;
+// render thread only, once it has started
+UploadScheduler uploads;
+// main thread -> render thread
+RenderQueue renderQueue;
+// render thread only, read once it has been joined
+AllocFrames renderFrames;
+JobSystem *jobs = NULL;
+renderMode mode = CHUNK_MODE;
+meshMode meshing = GREEDY;
+bool occlusionCulling = true;
+CavePVS pvs;
+PVSRebuilder pvsRebuild;
+bool pvsCulling = true;
+// simulation frames per second when not replaying
+const double SIM_STEP = 1.0 / 120.0;
+// how far away E can dig, in voxels
+const float DIG_REACH = 8.0f;
+bool showOverlay = false;
+// set while a flythrough drives the camera, so input can't change what is measured
+bool replaying = false;
 
 void mouseCallback(GLFWwindow* window, double xPos, double yPos) {
     if (firstMouse) {
@@ -96,6 +147,42 @@ void scrollCallback(GLFWwindow* window, double xOffset, double yOffset) {
     cam.ProcessMouseScroll(yOffset);
 }
 
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (action != GLFW_PRESS || replaying) {
+        return;
+    }
+    if (world != NULL && (key == GLFW_KEY_G || key == GLFW_KEY_O || key == GLFW_KEY_P || key == GLFW_KEY_E)) {
+        // remeshing, PVS, occlusion and digging only work on the fixed grid
+        return;
+    }
+    if (key == GLFW_KEY_M) {
+        // chunks -> one draw per cube -> one instanced draw -> chunks
+        mode = (mode == CHUNK_MODE) ? (CUBE_MODE) : ((mode == CUBE_MODE) ? (INSTANCED_MODE) : (CHUNK_MODE));
+    }
+    if (key == GLFW_KEY_G) {
+        meshing = (meshing == GREEDY) ? (CULLED) : (GREEDY);
+        grid->markAllDirty();
+    }
+    if (key == GLFW_KEY_O) {
+        occlusionCulling = !occlusionCulling;
+    }
+    if (key == GLFW_KEY_P) {
+        pvsCulling = !pvsCulling;
+    }
+    if (key == GLFW_KEY_F3) {
+        showOverlay = !showOverlay;
+    }
+    if (key == GLFW_KEY_E) {
+        // dig out the voxel the camera is looking at
+        RayHit hit = Raycaster(grid).cast(cam.Pos, cam.Front, DIG_REACH);
+        if (hit.hit) {
+            grid->setVoxel(hit.voxel.x, hit.voxel.y, hit.voxel.z, AIR);
+            // digging can open new lines of sight
+            pvsRebuild.edited(pvs);
+        }
+    }
+}
+
 GLFWwindow *setupWindow() {
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -112,11 +199,12 @@ GLFWwindow *setupWindow() {
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetCursorPosCallback(window, mouseCallback);
     glfwSetScrollCallback(window, scrollCallback);
+    glfwSetKeyCallback(window, keyCallback);
     return window;
 }
 
 void resizeWindow(GLFWwindow* window, int w, int h) {
-    glViewport(0, 0, w, h);
+    // the render thread picks the new size up with the next list
     width = w;
     height = h;
 }
@@ -152,7 +240,6 @@ void processInput(GLFWwindow* window) {
 }
 
 unsigned int textureSetup(std::string texturePath) {
-    const char* path = texturePath.c_str();
     unsigned int texture;
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
@@ -161,19 +248,35 @@ unsigned int textureSetup(std::string texturePath) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // a single white texel until the decoded image lands, so early frames sample a complete texture
+    const unsigned char placeholder[4] = { 255, 255, 255, 255 };
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
 
-    int width, height, nrChannels;
+    // decode on a worker, then hand the pixels back to the GL thread
     stbi_set_flip_vertically_on_load(true);
-    unsigned char* data = stbi_load(path, &width, &height, &nrChannels, 0);
-    if (data) {
-        auto flag = (texturePath.find(".png") == std::string::npos) ? (GL_RGB) : (GL_RGBA);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, flag, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else {
-        std::cerr << "Failed to load texture" << std::endl;
-    }
-    stbi_image_free(data);
+    jobs->launch([texture, texturePath]() {
+        TRACE_ZONE("decode texture");
+        int width, height, nrChannels;
+        unsigned char* data = stbi_load(texturePath.c_str(), &width, &height, &nrChannels, 0);
+        int64_t decoded = (data != NULL) ? (int64_t)width * height * nrChannels : 0;
+        MemoryTracker::get().add(MEM_TEXTURES, decoded);
+        jobs->runOnRenderThread([=]() {
+            TRACE_ZONE("upload texture");
+            if (data) {
+                auto flag = (texturePath.find(".png") == std::string::npos) ? (GL_RGB) : (GL_RGBA);
+                glBindTexture(GL_TEXTURE_2D, texture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, flag, GL_UNSIGNED_BYTE, data);
+                glGenerateMipmap(GL_TEXTURE_2D);
+                // drivers pad RGB to 4 bytes, and the mip chain adds a third
+                MemoryTracker::get().add(MEM_TEXTURES, (int64_t)width * height * 4 * 4 / 3);
+            }
+            else {
+                std::cerr << "Failed to load texture " << texturePath << std::endl;
+            }
+            stbi_image_free(data);
+            MemoryTracker::get().release(MEM_TEXTURES, decoded);
+        });
+    });
     return texture;
 }
 
@@ -209,23 +312,394 @@ void initBuffers(unsigned int **buffers) {
     glEnable(GL_DEPTH_TEST);
 }
 
-void rayCast() {
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            float x = (2.0f * w) / width - 1.0f;
-            float y = 1.0f - (2.0f * h) / height;
-            glm::vec3 loc = glm::inverse(view) * glm::inverse(projection) * glm::vec4(x, y, -1.0, 1.0);
-            glm::vec3 ray = loc - cam.Pos;
+void uploadInstances(unsigned int VAO, unsigned int instanceVBO) {
+    // one vec3 offset per cube, advanced once per instance of the 36-vertex cube
+    std::vector<glm::vec3> offsets;
+    offsets.reserve(cubePositions.size());
+    for (auto cube : cubePositions) {
+        offsets.push_back(cube->cubePos);
+    }
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, offsets.size() * sizeof(glm::vec3), offsets.data(), GL_STATIC_DRAW);
+    MemoryTracker::get().release(MEM_GPU, instanceBytes);
+    instanceBytes = offsets.size() * sizeof(glm::vec3);
+    MemoryTracker::get().add(MEM_GPU, instanceBytes);
+
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void uploadChunk(Chunk* chunk, std::vector<packedVertex>& mesh) {
+    // goes out with the next render list; the chunk keeps drawing its old mesh until the upload lands
+    chunk->vertexCount = (int)mesh.size();
+    renderQueue.submitMesh(chunk, mesh);
+}
+
+void remeshDirty(bool report) {
+    // edits remesh a handful of chunks mid-frame; only the initial build is worth a line, the rest shows in the trace
+    if (grid->dirtyChunks.empty()) {
+        return;
+    }
+    TRACE_ZONE("remeshDirty");
+    static MPSCQueue<MeshResult*> results;
+    double start = glfwGetTime();
+    std::atomic<int> remaining((int)grid->dirtyChunks.size());
+    for (auto chunk : grid->dirtyChunks) {
+        chunk->dirty = false;
+        meshAsync(jobs, grid, chunk, meshing, &results, &remaining);
+    }
+
+    // upload meshes as they arrive and help with meshing in between
+    int faces = 0;
+    MeshResult* result;
+    while (true) {
+        // read before popping: once it is 0 every result has been pushed
+        bool finished = (remaining == 0);
+        if (results.pop(result)) {
+            uploadChunk(result->chunk, result->vertices);
+            faces += result->faceCount;
+            delete(result);
+        }
+        else if (finished) {
+            break;
+        }
+        else if (!jobs->runOne()) {
+            std::this_thread::yield();
+        }
+    }
+    if (report) {
+        std::cout << "Remeshed " << grid->dirtyChunks.size() << " chunks, " << faces * 2 << " triangles ("
+            << ((meshing == GREEDY) ? "greedy" : "culled") << "), "
+            << faces * 6 * sizeof(packedVertex) << " bytes of vertex data in "
+            << (glfwGetTime() - start) * 1000.0 << "ms" << std::endl;
+    }
+    grid->dirtyChunks.clear();
+}
+
+void releaseChunk(Chunk* chunk) {
+    chunk->vertexCount = 0;
+    renderQueue.releaseMesh(chunk);
+}
+
+void renderLoop(GLFWwindow* window, std::string profilePath, std::string replayPath) {
+    /*
+        The render thread owns the GL context. It draws whatever the newest
+        render list says, so a slow simulation frame shows up as a repeated
+        image rather than a dropped one. GL jobs queued with runOnRenderThread(),
+        like texture uploads, run here too.
+    */
+    TRACE_THREAD("render");
+    glfwMakeContextCurrent(window);
+    if (replaying) {
+        // frame times, not the display rate
+        glfwSwapInterval(0);
+    }
+    uploads.init((GLADloadproc)glfwGetProcAddress);
+
+    Shader shader("shaders/v.glsl", "shaders/f.glsl");
+    Shader cubeShader("shaders/cube_v.glsl", "shaders/f.glsl");
+    Shader instanceShader("shaders/instance_v.glsl", "shaders/f.glsl");
+    shader.bindBlock("Frame", FRAME_BINDING);
+    cubeShader.bindBlock("Frame", FRAME_BINDING);
+    instanceShader.bindBlock("Frame", FRAME_BINDING);
+    FrameUniforms frameUniforms;
+    FrameProfiler profiler;
+    ProfilerOverlay overlay;
+    if (!profilePath.empty()) {
+        profiler.openCsv(profilePath);
+    }
+
+    unsigned int VAO, VBO, EBO;
+    unsigned int *buffers[] = {&VAO, &VBO, &EBO};
+    initBuffers(buffers);
+    unsigned int instanceVBO;
+    glGenBuffers(1, &instanceVBO);
+    uploadInstances(VAO, instanceVBO);
+
+    unsigned int texture1 = textureSetup("textures/container.jpg");
+    unsigned int texture2 = textureSetup("textures/awesomeface.png");
+    shader.use();
+    shader.setInt("texture1", 0);
+    shader.setInt("texture2", 1);
+    cubeShader.use();
+    cubeShader.setInt("texture1", 0);
+    cubeShader.setInt("texture2", 1);
+    instanceShader.use();
+    instanceShader.setInt("texture1", 0);
+    instanceShader.setInt("texture2", 1);
+
+    int viewportWidth = 0;
+    int viewportHeight = 0;
+    bool started = false;
+    double lastStatus = 0.0;
+    while (renderQueue.isRunning()) {
+        RenderList* list;
+        bool fresh;
+        if (!acquireFrame(renderQueue, &list, &fresh)) {
+            continue;
+        }
+        TRACE_ZONE("render frame");
+        beginRenderFrame(*list, fresh, profiler, renderFrames);
+        profiler.beginPhase(PHASE_UPDATE);
+        {
+            ALLOC_SCOPE("upload");
+            runRenderWork(jobs, *list, uploads);
+            if (!started) {
+                // nothing to draw yet, so the first frame can take the whole grid
+                uploads.drain();
+                started = true;
+            }
+            else {
+                uploads.flush();
+            }
+        }
+        profiler.endPhase(PHASE_UPDATE);
+        if (list->width != viewportWidth || list->height != viewportHeight) {
+            viewportWidth = list->width;
+            viewportHeight = list->height;
+            glViewport(0, 0, viewportWidth, viewportHeight);
+        }
+
+        profiler.beginPass(PASS_SCENE);
+        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture1);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, texture2);
+
+        profiler.beginPhase(PHASE_UNIFORMS);
+        frameUniforms.update(list->view, list->projection, list->time);
+        profiler.endPhase(PHASE_UNIFORMS);
+
+        if (list->mode == CHUNK_MODE) {
+            ScopedTimer timer(profiler, PHASE_DRAW);
+            TRACE_ZONE("draw");
+            ALLOC_SCOPE("draw");
+            shader.use();
+            shader.setFloat(MIX_UNIFORM, list->mixVal);
+            // chunks share arena pages, so most draws need no VAO change
+            unsigned int boundVAO = 0;
+            int drawn = 0;
+            for (auto& draw : list->draws) {
+                const MeshPlacement* mesh = uploads.find(draw.chunk);
+                if (mesh == NULL) {
+                    // its first upload hasn't happened yet
+                    continue;
+                }
+                shader.setVec3(CHUNK_ORIGIN_UNIFORM, draw.origin);
+                if (mesh->VAO != boundVAO) {
+                    glBindVertexArray(mesh->VAO);
+                    boundVAO = mesh->VAO;
+                }
+                glDrawArrays(GL_TRIANGLES, mesh->first, mesh->count);
+                drawn++;
+            }
+            countRenderFrame(profiler, *list, fresh, drawn, drawn);
+        }
+        else if (list->mode == INSTANCED_MODE) {
+            ScopedTimer timer(profiler, PHASE_DRAW);
+            TRACE_ZONE("draw");
+            ALLOC_SCOPE("draw");
+            instanceShader.use();
+            instanceShader.setFloat(MIX_UNIFORM, list->mixVal);
+            glBindVertexArray(VAO);
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 36, (GLsizei)cubePositions.size());
+            countRenderFrame(profiler, *list, fresh, 1, 0);
+        }
+        else {
+            ScopedTimer timer(profiler, PHASE_DRAW);
+            TRACE_ZONE("draw");
+            ALLOC_SCOPE("draw");
+            cubeShader.use();
+            cubeShader.setFloat(MIX_UNIFORM, list->mixVal);
+            glBindVertexArray(VAO);
+            int i = 0;
+            for (auto cube : cubePositions) {
+                model = glm::mat4(1.0f);
+                model = glm::translate(model, cube->cubePos);
+                //model = glm::scale(model, glm::vec3(0.75));
+                //float angle = 20.0f * i;
+                //angle = (i % 3 == 0) ? (25.0 * (float)glfwGetTime()) : (angle);
+                //model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+                cubeShader.setMat4(MODEL_UNIFORM, model);
+                glDrawArrays(GL_TRIANGLES, 0, 36);
+                i++;
+            }
+            countRenderFrame(profiler, *list, fresh, i, 0);
+        }
+
+        profiler.endPass();
+
+        if (list->overlay) {
+            profiler.beginPass(PASS_OVERLAY);
+            ALLOC_SCOPE("overlay");
+            overlay.draw(profiler, list->width, list->height);
+            profiler.endPass();
+        }
+        if (glfwGetTime() - lastStatus > 1.0) {
+            renderQueue.setStatus(profiler.summary());
+            lastStatus = glfwGetTime();
+        }
+
+        profiler.beginPhase(PHASE_SWAP);
+        {
+            TRACE_ZONE("swap");
+            glfwSwapBuffers(window);
         }
+        profiler.endPhase(PHASE_SWAP);
+        endRenderFrame(profiler, renderFrames);
+    }
+
+    profiler.flush();
+    if (replaying) {
+        std::cout << "Replayed " << replayPath << ":" << std::endl;
+        profiler.report(std::cout);
+    }
+    uploads.report(std::cout);
+    glDeleteBuffers(1, &instanceVBO);
+    MemoryTracker::get().release(MEM_GPU, instanceBytes);
+    uploads.destroy();
+    glfwMakeContextCurrent(NULL);
+}
+
+int renderPreview(const std::string& path, int w, int h) {
+    // no window or GL context, so this also runs on machines without a GPU
+    CpuRenderer renderer(grid, jobs);
+    renderer.loadTexture("textures/wall.jpg");
+    renderer.render(cam, w, h);
+    std::cout << "Rendered " << w << "x" << h << " in " << renderer.renderMs << " ms on " << jobs->numWorkers() << " threads" << std::endl;
+    if (!renderer.save(path)) {
+        return -1;
+    }
+    std::cout << "Wrote " << path << std::endl;
+    return 0;
+}
+
+void writeTrace(const std::string& path) {
+    if (!path.empty()) {
+        Tracer::get().writeJson(path);
     }
 }
 
-int main() {
-    LSystem lsystem = LSystem("models/line.txt");
-    lsystem.parseFile();
-    cubePositions = lsystem.writeCubes();
-    if (cubePositions.empty()) {
-        std::cout << "welp" << std::endl;
+int main(int argc, char** argv) {
+    std::string modelPath = "models/line.txt";
+    std::string renderPath;
+    std::string outPath = "cave";
+    std::string profilePath;
+    std::string tracePath;
+    // with --alloc-check N, frames to measure after the warm-up
+    int allocCheckFrames = 0;
+    std::string recordPath;
+    std::string replayPath;
+    int streamRadius = 0;
+    uint32_t streamSeed = 1;
+    float prefetchSeconds = STREAM_PREFETCH_SECONDS;
+    bool headless = false;
+    int renderWidth = 1920;
+    int renderHeight = 1080;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            modelPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profilePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+            renderPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--alloc-check") == 0 && i + 1 < argc) {
+            allocCheckFrames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+            streamRadius = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            prefetchSeconds = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            streamSeed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc) {
+            uploads.bytesPerFrame = (int)(atof(argv[++i]) * 1024.0 * 1024.0);
+        }
+        else if (strcmp(argv[i], "--upload-ms") == 0 && i + 1 < argc) {
+            uploads.msPerFrame = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            if (!MemoryTracker::get().parseBudget(argv[++i])) {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc) {
+            renderWidth = atoi(argv[++i]);
+            renderHeight = atoi(argv[++i]);
+        }
+    }
+    Tracer::get().enabled = !tracePath.empty();
+
+    jobs = new JobSystem();
+    if (headless) {
+        // the whole CPU pipeline, results written under outPath
+        HeadlessPipeline pipeline(jobs, meshing);
+        int result = pipeline.run(modelPath, outPath);
+        writeTrace(tracePath);
+        delete(jobs);
+        return result;
+    }
+    LSystem lsystem(modelPath);
+    if (streamRadius > 0) {
+        // chunks come and go with the camera, nothing to build up front
+        grid = new VoxelGrid(NULL, 0);
+        world = new StreamingWorld(jobs, streamRadius, streamSeed);
+        world->meshing = meshing;
+        world->prefetchSeconds = prefetchSeconds;
+        world->uploadMesh = uploadChunk;
+        world->releaseMesh = releaseChunk;
+        occlusionCulling = false;
+        pvsCulling = false;
+    }
+    else {
+        lsystem.parseFile();
+        cubePositions = lsystem.writeCubes(jobs);
+        if (cubePositions.empty()) {
+            std::cout << "welp" << std::endl;
+        }
+        MemoryTracker::get().stage("cubes");
+        grid = new VoxelGrid(lsystem.matrix, lsystem.numCubes, jobs);
+        MemoryTracker::get().stage("voxelize");
+        if (!renderPath.empty()) {
+            int result = renderPreview(renderPath, renderWidth, renderHeight);
+            MemoryTracker::get().stage("render");
+            writeTrace(tracePath);
+            delete(grid);
+            lsystem.clearCubes();
+            delete(jobs);
+            return result;
+        }
+        pvs.loadOrBuild(grid, jobs, "pvs.cache");
+        MemoryTracker::get().stage("visibility");
     }
     GLFWwindow* window = setupWindow();
     if (window == NULL) {
@@ -237,72 +711,159 @@ int main() {
         return -1;
     }
 
-    Shader shader("shaders/v.glsl", "shaders/f.glsl");
+    FrustumCuller culler(grid);
+    OcclusionCuller occlusion;
+    double lastTitle = 0.0;
+    char title[192];
+    char status[160];
+    Flythrough flight;
+    replaying = !replayPath.empty();
+    if (replaying && !flight.load(replayPath)) {
+        return -1;
+    }
+    // a replay draws every simulated frame exactly once
+    renderQueue.lockstep = replaying;
+    double recordStart = glfwGetTime();
 
     model = glm::rotate(model, glm::radians(-55.0f), glm::vec3(1.0f, 0.0f, 0.0f));
     view = glm::translate(view, glm::vec3(0.0f, 0.0f, -3.0f));
-    projection = glm::perspective(glm::radians(cam.Fov), 800.0f / 600.0f, 0.1f, 100.0f);
+    // far enough to see the whole streamed radius
+    float farPlane = (world != NULL) ? std::max(100.0f, (float)((streamRadius + 1) * CHUNK_SIZE)) : 100.0f;
 
-    unsigned int VAO, VBO, EBO;
-    unsigned int *buffers[] = {&VAO, &VBO, &EBO};
-    initBuffers(buffers);
+    // the meshes go out with the first render list
+    remeshDirty(true);
+    MemoryTracker::get().stage("mesh");
 
-    glViewport(0, 0, 800, 600);
     glfwSetFramebufferSizeCallback(window, resizeWindow);
-
-    unsigned int texture1 = textureSetup("textures/container.jpg");
-    unsigned int texture2 = textureSetup("textures/awesomeface.png");
-    shader.use();
-    shader.setInt("texture1", 0);
-    shader.setInt("texture2", 1);
+    glfwGetFramebufferSize(window, &width, &height);
 
     glm::vec4 vec(1.0f, 0.0f, 0.0f, 1.0f);
     float val = 180.0f;
 
+    // from here on GL belongs to the render thread; this one keeps events, input and the simulation
+    glfwMakeContextCurrent(NULL);
+    std::thread renderer(renderLoop, window, profilePath, replayPath);
+
+    AllocTracker& allocs = AllocTracker::get();
+    allocs.enabled = (allocCheckFrames > 0);
+    AllocFrames simFrames;
+    long long frame = 0;
+    double nextTick = glfwGetTime();
     while (!glfwWindowShouldClose(window)) {
-        float currFrame = glfwGetTime();
+        TRACE_ZONE("frame");
+        simFrames.beginFrame();
+        RenderList& list = renderQueue.writing();
+        double phaseStart = glfwGetTime();
+        float currFrame = (float)phaseStart;
         deltaTime = currFrame - lastFrame;
         lastFrame = currFrame;
+        glfwPollEvents();
         processInput(window);
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture1);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, texture2);
-
-        glBindVertexArray(VAO);
-        
-        shader.use();
-        shader.setFloat("mixVal", mixVal);
-        int i = 0;
-        for (auto cube : cubePositions) {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, cube->cubePos);
-            //model = glm::scale(model, glm::vec3(0.75));
-            //float angle = 20.0f * i;
-            //angle = (i % 3 == 0) ? (25.0 * (float)glfwGetTime()) : (angle);
-            //model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-            shader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
-            i++;
+        if (replaying) {
+            deltaTime = (float)REPLAY_STEP;
+            flight.apply((int)frame, cam);
+        }
+        else if (!recordPath.empty()) {
+            flight.record(currFrame - recordStart, cam);
         }
+        double now = glfwGetTime();
+        list.inputMs = (now - phaseStart) * 1000.0;
+        phaseStart = now;
+        {
+            ALLOC_SCOPE("update");
+            remeshDirty(false);
+            if (world != NULL) {
+                world->update(cam.Pos, cam.Front, deltaTime);
+            }
+            else {
+                pvsRebuild.update(pvs, grid, jobs);
+            }
+        }
+        now = glfwGetTime();
+        list.updateMs = (now - phaseStart) * 1000.0;
+        phaseStart = now;
+
         view = glm::mat4(1.0f);
         const float radius = 10.0f;
         //float camX = sin(glfwGetTime()) * radius;
         //float camZ = cos(glfwGetTime()) * radius;
         //camPos = glm::vec3(camX, 0.0, camZ);
         view = cam.GetViewMatrix();
-        shader.setMat4("view", view);
-        shader.setMat4("projection", projection);
+        // every frame, so a zoom (or a replayed one) reaches culling and the draw
+        projection = glm::perspective(glm::radians(cam.Fov), 800.0f / 600.0f, 0.1f, farPlane);
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (mode == CHUNK_MODE) {
+            cullIntoList(list, grid, world, culler, pvsCulling ? &pvs : NULL, occlusionCulling ? &occlusion : NULL, projection * view, cam.Pos);
+        }
+        list.cullingMs = (glfwGetTime() - phaseStart) * 1000.0;
+
+        list.frame = frame;
+        list.time = currFrame;
+        list.width = width;
+        list.height = height;
+        list.mode = mode;
+        list.overlay = showOverlay;
+        list.mixVal = mixVal;
+        list.view = view;
+        list.projection = projection;
+        renderQueue.publish();
+
+        if (currFrame - lastTitle > 1.0) {
+            renderQueue.getStatus(status, sizeof(status));
+            snprintf(title, sizeof(title), "Procedural Cave Generator | %s", status);
+            glfwSetWindowTitle(window, title);
+            lastTitle = currFrame;
+        }
+        simFrames.endFrame();
+        frame++;
+        if (replaying && frame >= flight.frameCount()) {
+            glfwSetWindowShouldClose(window, true);
+        }
+        if (allocCheckFrames > 0 && simFrames.frames == ALLOC_WARMUP_FRAMES + allocCheckFrames) {
+            glfwSetWindowShouldClose(window, true);
+        }
+        if (!renderQueue.lockstep) {
+            // the render thread keeps the display rate; simulating faster would only be thrown away
+            nextTick += SIM_STEP;
+            double wait = nextTick - glfwGetTime();
+            if (wait > 0.0) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+            }
+            else {
+                // running late, don't try to catch up
+                nextTick = glfwGetTime();
+            }
+        }
+    }
+    renderQueue.stop();
+    renderer.join();
+    allocs.enabled = false;
+    if (!recordPath.empty()) {
+        flight.save(recordPath);
+    }
+    if (world != NULL) {
+        world->prefetch.report(std::cout);
     }
 
+    writeTrace(tracePath);
+    MemoryTracker::get().report(std::cout);
+    // GL is gone with the render thread; the releases this queues are dropped
+    delete(world);
+    renderQueue.discard();
+    pvsRebuild.finish();
+    delete(grid);
     lsystem.clearCubes();
+    delete(jobs);
 
     glfwTerminate();
+    if (allocCheckFrames > 0) {
+        allocs.report(std::cout);
+        simFrames.report(std::cout, "simulation");
+        renderFrames.report(std::cout, "render");
+        if (!simFrames.steadyStateClean() || !renderFrames.steadyStateClean()) {
+            std::cerr << "Frame loop allocated after warm-up" << std::endl;
+            return -1;
+        }
+    }
 	return 0;
 }
@@ -0,0 +1,151 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+
+typedef enum memTag {
+	MEM_GRAMMAR,
+	MEM_VOXELS,
+	MEM_MESHES,
+	MEM_GPU,
+	MEM_TEXTURES,
+	MEM_TAG_COUNT
+} memTag;
+
+const char* const MEM_TAG_NAMES[MEM_TAG_COUNT] = { "grammar", "voxels", "meshes", "gpu buffers", "textures" };
+
+class MemoryTracker {
+public:
+	/*
+		Memory accounting
+		---------------------
+		Each subsystem reports the bytes it holds under its tag when it
+		allocates or frees them:
+			grammar      LSystem rewrite strings
+			voxels       LSystem matrix and cubes, grid chunks
+			meshes       CPU-side vertex data
+			gpu buffers  what was handed to glBufferData
+			textures     decoded images and their GL copies
+		Counters are atomic so workers can report too. stage() prints the
+		current and peak bytes per tag and the peak total since the last
+		stage, then checks it against that stage's budget, if one was set.
+		Going over a budget ends the program.
+		---------------------
+	*/
+	// skips the per-stage lines, budgets are still enforced
+	bool quiet;
+
+	static MemoryTracker& get() {
+		static MemoryTracker tracker;
+		return tracker;
+	}
+
+	void add(memTag tag, int64_t bytes) {
+		raise(peak[tag], current[tag].fetch_add(bytes) + bytes);
+		int64_t total = totalCurrent.fetch_add(bytes) + bytes;
+		raise(totalPeak, total);
+		raise(stagePeak, total);
+	}
+
+	void release(memTag tag, int64_t bytes) {
+		current[tag] -= bytes;
+		totalCurrent -= bytes;
+	}
+
+	int64_t bytes(memTag tag) const {
+		return current[tag];
+	}
+
+	int64_t peakBytes(memTag tag) const {
+		return peak[tag];
+	}
+
+	int64_t total() const {
+		return totalCurrent;
+	}
+
+	int64_t peakTotal() const {
+		return totalPeak;
+	}
+
+	void setBudget(const std::string& stageName, int64_t bytes) {
+		budgets[stageName] = bytes;
+	}
+
+	bool parseBudget(const std::string& arg) {
+		// stage=MB, e.g. voxelize=512
+		size_t eq = arg.find('=');
+		if (eq == std::string::npos || eq == 0) {
+			std::cerr << "Bad budget " << arg << ", expected stage=MB" << std::endl;
+			return false;
+		}
+		setBudget(arg.substr(0, eq), (int64_t)(std::atof(arg.c_str() + eq + 1) * 1024.0 * 1024.0));
+		return true;
+	}
+
+	void stage(const std::string& name, std::ostream& os = std::cout) {
+		int64_t stageMax = stagePeak.exchange(totalCurrent);
+		if (!quiet) {
+			os << "memory after " << name << ":";
+			for (int t = 0; t < MEM_TAG_COUNT; t++) {
+				if (peak[t] > 0) {
+					os << " " << MEM_TAG_NAMES[t] << " " << mb(current[t]) << "/" << mb(peak[t]);
+				}
+			}
+			os << " | stage peak " << mb(stageMax) << " MB" << std::endl;
+		}
+		auto budget = budgets.find(name);
+		if (budget != budgets.end() && stageMax > budget->second) {
+			std::cerr << "Stage " << name << " peaked at " << mb(stageMax) << " MB, over its budget of "
+				<< mb(budget->second) << " MB" << std::endl;
+			exit(-1);
+		}
+	}
+
+	void report(std::ostream& os) const {
+		os << std::left << std::setw(12) << "memory" << std::right << std::setw(10) << "current" << std::setw(10) << "peak" << " MB" << std::endl;
+		for (int t = 0; t < MEM_TAG_COUNT; t++) {
+			os << std::left << std::setw(12) << MEM_TAG_NAMES[t] << std::right << std::setw(10) << mb(current[t])
+				<< std::setw(10) << mb(peak[t]) << std::endl;
+		}
+		os << std::left << std::setw(12) << "total" << std::right << std::setw(10) << mb(totalCurrent)
+			<< std::setw(10) << mb(totalPeak) << std::endl;
+	}
+
+private:
+	std::atomic<int64_t> current[MEM_TAG_COUNT];
+	std::atomic<int64_t> peak[MEM_TAG_COUNT];
+	std::atomic<int64_t> totalCurrent;
+	std::atomic<int64_t> totalPeak;
+	std::atomic<int64_t> stagePeak;
+	std::map<std::string, int64_t> budgets;
+
+	MemoryTracker() : totalCurrent(0), totalPeak(0), stagePeak(0) {
+		for (int t = 0; t < MEM_TAG_COUNT; t++) {
+			current[t] = 0;
+			peak[t] = 0;
+		}
+		quiet = false;
+	}
+
+	static void raise(std::atomic<int64_t>& high, int64_t value) {
+		int64_t seen = high.load();
+		while (value > seen && !high.compare_exchange_weak(seen, value)) {
+		}
+	}
+
+	static std::string mb(int64_t bytes) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%.2f", bytes / (1024.0 * 1024.0));
+		return buf;
+	}
+};
+
+#endif
@@ -0,0 +1,413 @@
+#ifndef MESHER_H
+#define MESHER_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "chunk.h"
+#include "jobs.h"
+#include "mpsc_queue.h"
+#include "memory.h"
+#include "tracer.h"
+
+/*
+	Packed chunk vertex, decoded in shaders/v.glsl
+	---------------------
+	bits  0-5   x within chunk (0 - 32)
+	bits  6-11  y within chunk
+	bits 12-17  z within chunk
+	bits 18-20  faceDir
+	bits 21-22  ambient occlusion (3 = unoccluded)
+	bits 23-30  material
+	---------------------
+	Texture coordinates are rebuilt from the position along the face's u/v
+	axes, so greedy quads tile without storing a UV per corner.
+*/
+typedef uint32_t packedVertex;
+
+inline packedVertex packVertex(glm::ivec3 pos, int face, int ao, unsigned char mat) {
+	return (packedVertex)pos.x | ((packedVertex)pos.y << 6) | ((packedVertex)pos.z << 12) |
+		((packedVertex)face << 18) | ((packedVertex)ao << 21) | ((packedVertex)mat << 23);
+}
+
+typedef enum meshMode {
+	CULLED,
+	GREEDY
+} meshMode;
+
+class Mesher {
+public:
+	meshMode mode;
+	int faceCount;
+
+	Mesher(meshMode m = GREEDY) {
+		mode = m;
+		faceCount = 0;
+	}
+
+	// Grid is anything with chunkAt(cx, cy, cz): the VoxelGrid or a streamed neighbourhood
+	template <class Grid>
+	void mesh(const Grid* grid, const Chunk* chunk, std::vector<packedVertex>& out) {
+		TRACE_ZONE("mesh chunk");
+		out.clear();
+		faceCount = 0;
+		if (chunk->empty()) {
+			return;
+		}
+		buildColumns(grid, chunk);
+		buildFaceMasks();
+		buildShadeMasks();
+
+		if (mode == GREEDY) {
+			meshGreedy(chunk, out);
+			return;
+		}
+
+		int ao[4];
+		for (int d = 0; d < 6; d++) {
+			for (int x = 0; x < CHUNK_SIZE; x++) {
+				for (int y = 0; y < CHUNK_SIZE; y++) {
+					uint32_t bits = faces[d][x][y];
+					while (bits) {
+						int z = ctz32(bits);
+						bits &= bits - 1;
+						glm::ivec3 voxel(x, y, z);
+						if ((shaded[d][x][y] >> z) & 1) {
+							cornerAO((faceDir)d, voxel, ao);
+						}
+						else {
+							ao[0] = ao[1] = ao[2] = ao[3] = 3;
+						}
+						emitQuad(out, (faceDir)d, voxel, 1, 1, chunk->get(x, y, z), ao);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	// cols[x + 1][y + 1] has bit z + 1 set when voxel (x, y, z) of the chunk is
+	// solid; the outer ring and bits 0 / CHUNK_SIZE + 1 come from neighbours
+	uint64_t cols[CHUNK_PAD][CHUNK_PAD];
+	// faces[d][x][y] has bit z set when voxel (x, y, z) shows a face towards d
+	uint32_t faces[6][CHUNK_SIZE][CHUNK_SIZE];
+	// subset of faces with at least one solid voxel around them in the air layer
+	uint32_t shaded[6][CHUNK_SIZE][CHUNK_SIZE];
+	// faceKey() of every face in the slice being merged, [v][u]
+	int keys[CHUNK_SIZE][CHUNK_SIZE];
+
+	template <class Grid>
+	void buildColumns(const Grid* grid, const Chunk* chunk) {
+		glm::ivec3 c = chunk->coord;
+		for (int px = 0; px < CHUNK_PAD; px++) {
+			int x = px - 1;
+			int dx = (x < 0) ? -1 : ((x >= CHUNK_SIZE) ? 1 : 0);
+			int lx = x - dx * CHUNK_SIZE;
+			for (int py = 0; py < CHUNK_PAD; py++) {
+				int y = py - 1;
+				int dy = (y < 0) ? -1 : ((y >= CHUNK_SIZE) ? 1 : 0);
+				int ly = y - dy * CHUNK_SIZE;
+
+				const Chunk* mid = grid->chunkAt(c.x + dx, c.y + dy, c.z);
+				const Chunk* below = grid->chunkAt(c.x + dx, c.y + dy, c.z - 1);
+				const Chunk* above = grid->chunkAt(c.x + dx, c.y + dy, c.z + 1);
+
+				uint64_t col = mid ? ((uint64_t)mid->solid[lx][ly] << 1) : 0;
+				if (below) {
+					col |= (below->solid[lx][ly] >> (CHUNK_SIZE - 1)) & 1;
+				}
+				if (above) {
+					col |= (uint64_t)(above->solid[lx][ly] & 1) << (CHUNK_SIZE + 1);
+				}
+				cols[px][py] = col;
+			}
+		}
+	}
+
+	void buildFaceMasks() {
+		// a face is visible where a solid bit meets an air bit in the neighbouring word
+		for (int x = 0; x < CHUNK_SIZE; x++) {
+			for (int y = 0; y < CHUNK_SIZE; y++) {
+				uint64_t c = cols[x + 1][y + 1];
+				faces[POS_X][x][y] = (uint32_t)((c & ~cols[x + 2][y + 1]) >> 1);
+				faces[NEG_X][x][y] = (uint32_t)((c & ~cols[x][y + 1]) >> 1);
+				faces[POS_Y][x][y] = (uint32_t)((c & ~cols[x + 1][y + 2]) >> 1);
+				faces[NEG_Y][x][y] = (uint32_t)((c & ~cols[x + 1][y]) >> 1);
+				faces[POS_Z][x][y] = (uint32_t)((c & ~(c >> 1)) >> 1);
+				faces[NEG_Z][x][y] = (uint32_t)((c & ~(c << 1)) >> 1);
+			}
+		}
+	}
+
+	uint64_t dilateZ(uint64_t c) {
+		return c | (c << 1) | (c >> 1);
+	}
+
+	void buildShadeMasks() {
+		/*
+			A face can only be darkened by the 3x3 block of voxels in the air
+			layer in front of it. OR-ing the neighbouring columns (and the
+			columns shifted one bit along z) gives that block for every face of
+			a column at once; faces with nothing around them keep AO 3 and can
+			be merged freely.
+		*/
+		for (int x = 0; x < CHUNK_SIZE; x++) {
+			for (int y = 0; y < CHUNK_SIZE; y++) {
+				int px = x + 1;
+				int py = y + 1;
+				uint64_t posX = 0, negX = 0, posY = 0, negY = 0, layerZ = 0;
+				for (int o = -1; o <= 1; o++) {
+					posX |= dilateZ(cols[px + 1][py + o]);
+					negX |= dilateZ(cols[px - 1][py + o]);
+					posY |= dilateZ(cols[px + o][py + 1]);
+					negY |= dilateZ(cols[px + o][py - 1]);
+					for (int q = -1; q <= 1; q++) {
+						layerZ |= cols[px + o][py + q];
+					}
+				}
+				shaded[POS_X][x][y] = faces[POS_X][x][y] & (uint32_t)(posX >> 1);
+				shaded[NEG_X][x][y] = faces[NEG_X][x][y] & (uint32_t)(negX >> 1);
+				shaded[POS_Y][x][y] = faces[POS_Y][x][y] & (uint32_t)(posY >> 1);
+				shaded[NEG_Y][x][y] = faces[NEG_Y][x][y] & (uint32_t)(negY >> 1);
+				shaded[POS_Z][x][y] = faces[POS_Z][x][y] & (uint32_t)(layerZ >> 2);
+				shaded[NEG_Z][x][y] = faces[NEG_Z][x][y] & (uint32_t)layerZ;
+			}
+		}
+	}
+
+	int solidAt(glm::ivec3 p) {
+		// p is chunk-local and may lie one voxel outside the chunk
+		return (int)((cols[p.x + 1][p.y + 1] >> (p.z + 1)) & 1);
+	}
+
+	void faceAxes(faceDir d, glm::ivec3& n, glm::ivec3& u, glm::ivec3& v) {
+		/*
+			x faces: u = z, v = y
+			y faces: u = z, v = x
+			z faces: u = x, v = y
+		*/
+		int axis = d / 2;
+		n = glm::ivec3(0);
+		u = glm::ivec3(0);
+		v = glm::ivec3(0);
+		n[axis] = 1;
+		u[(axis == 2) ? 0 : 2] = 1;
+		v[(axis == 1) ? 0 : 1] = 1;
+	}
+
+	void cornerAO(faceDir d, glm::ivec3 voxel, int ao[4]) {
+		// classic 3-neighbour rule: two solid sides fully occlude the corner
+		glm::ivec3 n, u, v;
+		faceAxes(d, n, u, v);
+		glm::ivec3 layer = voxel + (((d % 2) == 0) ? n : -n);
+		const int cu[4] = { -1, 1, 1, -1 };
+		const int cv[4] = { -1, -1, 1, 1 };
+		for (int k = 0; k < 4; k++) {
+			int side1 = solidAt(layer + u * cu[k]);
+			int side2 = solidAt(layer + v * cv[k]);
+			int corner = solidAt(layer + u * cu[k] + v * cv[k]);
+			ao[k] = (side1 && side2) ? 0 : 3 - (side1 + side2 + corner);
+		}
+	}
+
+	void sliceRows(const uint32_t src[CHUNK_SIZE][CHUNK_SIZE], int axis, int s, uint32_t rows[CHUNK_SIZE]) {
+		// rows[v] holds the faces of slice s with bit u set, see faceAxes
+		for (int r = 0; r < CHUNK_SIZE; r++) {
+			if (axis == 0) {
+				rows[r] = src[s][r];
+			}
+			else if (axis == 1) {
+				rows[r] = src[r][s];
+			}
+			else {
+				uint32_t row = 0;
+				for (int x = 0; x < CHUNK_SIZE; x++) {
+					row |= ((src[x][r] >> s) & 1) << x;
+				}
+				rows[r] = row;
+			}
+		}
+	}
+
+	glm::ivec3 sliceVoxel(int axis, int s, int u, int v) {
+		if (axis == 0) {
+			return glm::ivec3(s, v, u);
+		}
+		if (axis == 1) {
+			return glm::ivec3(v, s, u);
+		}
+		return glm::ivec3(u, v, s);
+	}
+
+	bool mixedMaterials(const Chunk* chunk) {
+		unsigned char first = AIR;
+		const unsigned char* v = &chunk->voxels[0][0][0];
+		for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE; i++) {
+			if (v[i] == AIR) {
+				continue;
+			}
+			if (first == AIR) {
+				first = v[i];
+			}
+			else if (v[i] != first) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	int faceKey(const Chunk* chunk, faceDir d, glm::ivec3 voxel, bool withAO) {
+		// material in the low byte, the four corner AO values above it
+		int key = chunk->get(voxel.x, voxel.y, voxel.z);
+		if (withAO) {
+			int ao[4];
+			cornerAO(d, voxel, ao);
+			key |= (ao[0] | (ao[1] << 2) | (ao[2] << 4) | (ao[3] << 6)) << 8;
+		}
+		return key;
+	}
+
+	bool sameKey(int u0, int w, int v, int key) {
+		for (int u = u0; u < u0 + w; u++) {
+			if (keys[v][u] != key) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void mergeRows(const Chunk* chunk, faceDir d, int s, uint32_t rows[CHUNK_SIZE], bool checkKey, bool withAO, std::vector<packedVertex>& out) {
+		/*
+			Take the lowest set bit of a row, extend it along u to the end of
+			its run of set bits, then extend down the rows while the same span
+			is fully set. The covered bits are cleared and the rectangle
+			becomes one quad. Faces only need comparing when the chunk mixes
+			materials or the faces carry AO.
+		*/
+		int axis = d / 2;
+		if (checkKey) {
+			for (int r = 0; r < CHUNK_SIZE; r++) {
+				uint32_t bits = rows[r];
+				while (bits) {
+					int u = ctz32(bits);
+					bits &= bits - 1;
+					keys[r][u] = faceKey(chunk, d, sliceVoxel(axis, s, u, r), withAO);
+				}
+			}
+		}
+
+		int ao[4];
+		for (int r = 0; r < CHUNK_SIZE; r++) {
+			while (rows[r]) {
+				int start = ctz32(rows[r]);
+				uint32_t run = ~(rows[r] >> start);
+				int w = run ? ctz32(run) : CHUNK_SIZE - start;
+
+				glm::ivec3 first = sliceVoxel(axis, s, start, r);
+				int key = checkKey ? keys[r][start] : faceKey(chunk, d, first, false);
+				if (checkKey) {
+					int same = 1;
+					while (same < w && keys[r][start + same] == key) {
+						same++;
+					}
+					w = same;
+				}
+
+				uint32_t span = ((w == 32) ? 0xFFFFFFFFu : ((1u << w) - 1)) << start;
+				int h = 1;
+				while (r + h < CHUNK_SIZE && (rows[r + h] & span) == span) {
+					if (checkKey && !sameKey(start, w, r + h, key)) {
+						break;
+					}
+					h++;
+				}
+				for (int k = r; k < r + h; k++) {
+					rows[k] &= ~span;
+				}
+				for (int k = 0; k < 4; k++) {
+					ao[k] = withAO ? (key >> (8 + 2 * k)) & 3 : 3;
+				}
+				emitQuad(out, d, first, w, h, (unsigned char)(key & 0xFF), ao);
+			}
+		}
+	}
+
+	void meshGreedy(const Chunk* chunk, std::vector<packedVertex>& out) {
+		bool mixed = mixedMaterials(chunk);
+		uint32_t rows[CHUNK_SIZE];
+		uint32_t shadedRows[CHUNK_SIZE];
+
+		for (int d = 0; d < 6; d++) {
+			int axis = d / 2;
+			for (int s = 0; s < CHUNK_SIZE; s++) {
+				sliceRows(faces[d], axis, s, rows);
+				sliceRows(shaded[d], axis, s, shadedRows);
+				for (int r = 0; r < CHUNK_SIZE; r++) {
+					rows[r] &= ~shadedRows[r];
+				}
+				mergeRows(chunk, (faceDir)d, s, rows, mixed, false, out);
+				mergeRows(chunk, (faceDir)d, s, shadedRows, true, true, out);
+			}
+		}
+	}
+
+	void emitQuad(std::vector<packedVertex>& out, faceDir d, glm::ivec3 voxel, int w, int h, unsigned char mat, const int ao[4]) {
+		// w voxels along u, h along v; corners wound counter-clockwise seen from outside
+		int axis = d / 2;
+		bool positive = (d % 2) == 0;
+		glm::ivec3 n, u, v;
+		faceAxes(d, n, u, v);
+
+		glm::ivec3 base = voxel + (positive ? n : glm::ivec3(0));
+		glm::ivec3 pos[4] = { base, base + u * w, base + u * w + v * h, base + v * h };
+
+		// cross(u, v) points along -x for x faces, +y and +z otherwise
+		bool flip = (axis == 0) ? positive : !positive;
+		// split along the brighter diagonal so AO interpolates without a crease
+		bool rotate = ao[0] + ao[2] < ao[1] + ao[3];
+		const int order[2][6] = { { 0, 1, 2, 2, 3, 0 }, { 1, 2, 3, 3, 0, 1 } };
+		const int flipped[2][6] = { { 0, 3, 2, 2, 1, 0 }, { 1, 0, 3, 3, 2, 1 } };
+		for (int i = 0; i < 6; i++) {
+			int k = flip ? flipped[rotate][i] : order[rotate][i];
+			out.push_back(packVertex(pos[k], d, ao[k], mat));
+		}
+		faceCount++;
+	}
+};
+
+class MeshResult {
+public:
+	Chunk* chunk;
+	std::vector<packedVertex> vertices;
+	int faceCount;
+
+	~MeshResult() {
+		MemoryTracker::get().release(MEM_MESHES, vertices.capacity() * sizeof(packedVertex));
+	}
+};
+
+inline void meshAsync(JobSystem* jobs, const VoxelGrid* grid, Chunk* chunk, meshMode mode,
+	MPSCQueue<MeshResult*>* results, std::atomic<int>* remaining) {
+	/*
+		Meshes chunk on a worker and publishes the result to results. The
+		mesher's masks and the vertex buffer are per-thread scratch reused
+		across jobs, so a job only allocates the exact-size copy it hands
+		over. No GL calls happen here; the consumer uploads.
+	*/
+	jobs->launch([=]() {
+		static thread_local Mesher mesher;
+		static thread_local std::vector<packedVertex> scratch;
+		mesher.mode = mode;
+		mesher.mesh(grid, chunk, scratch);
+
+		MeshResult* result = new MeshResult();
+		result->chunk = chunk;
+		result->vertices.assign(scratch.begin(), scratch.end());
+		MemoryTracker::get().add(MEM_MESHES, result->vertices.capacity() * sizeof(packedVertex));
+		result->faceCount = mesher.faceCount;
+		results->push(result);
+		(*remaining)--;
+	});
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+
+template <typename T>
+class MPSCQueue {
+public:
+	/*
+		Lock-free multi-producer single-consumer queue (Vyukov). Producers
+		swing head with one atomic exchange and then link the old head to
+		the new node; the single consumer walks from tail. A push that has
+		exchanged but not yet linked is simply not visible to pop() yet.
+	*/
+	MPSCQueue() {
+		Node* stub = new Node();
+		head.store(stub);
+		tail = stub;
+	}
+
+	~MPSCQueue() {
+		T item;
+		while (pop(item)) {
+		}
+		delete(tail);
+	}
+
+	void push(const T& item) {
+		Node* node = new Node();
+		node->value = item;
+		Node* prev = head.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+	}
+
+	bool pop(T& item) {
+		// consumer thread only
+		Node* next = tail->next.load(std::memory_order_acquire);
+		if (next == NULL) {
+			return false;
+		}
+		item = next->value;
+		delete(tail);
+		tail = next;
+		return true;
+	}
+
+private:
+	class Node {
+	public:
+		std::atomic<Node*> next;
+		T value;
+
+		Node() : next(NULL), value() {}
+	};
+
+	std::atomic<Node*> head;
+	Node* tail;
+};
+
+#endif
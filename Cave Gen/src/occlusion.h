@@ -0,0 +1,362 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+#include "chunk.h"
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+// resolution of the software depth buffer; width must be a multiple of 4
+const int OCC_WIDTH = 256;
+const int OCC_HEIGHT = 192;
+// nearest occluders rasterized per frame
+const int MAX_OCCLUDERS = 768;
+
+class OcclusionCuller {
+public:
+	/*
+		Software occlusion culling
+		---------------------
+		1. Fully solid 8^3 bricks (whole chunks when all 64 are solid) of
+		   every chunk inside the frustum are the occluders, including solid
+		   chunks with no mesh, which are the rock between caves. They are
+		   solid rock, so anything behind them really is hidden.
+		2. The nearest MAX_OCCLUDERS are rasterized into a small depth
+		   buffer, four pixels at a time.
+		3. A max-depth mip pyramid is built over it.
+		4. Each chunk's box is projected, and the level where its screen rect
+		   covers at most 2x2 texels is read. If the box's nearest depth is
+		   behind the farthest depth there, the chunk is hidden.
+		---------------------
+		Nothing here touches the GPU, so culling rates can be checked
+		headlessly.
+	*/
+	int occludersDrawn;
+	int chunksTested;
+	int chunksCulled;
+
+	OcclusionCuller() {
+		int w = OCC_WIDTH;
+		int h = OCC_HEIGHT;
+		while (true) {
+			levelWidth.push_back(w);
+			levelHeight.push_back(h);
+			levels.push_back(std::vector<float>(w * h, 1.0f));
+			if (w == 1 && h == 1) {
+				break;
+			}
+			// round up so every texel has all its children, even on odd sizes
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+		}
+		occluders.reserve(MAX_OCCLUDERS * 2);
+		occludersDrawn = 0;
+		chunksTested = 0;
+		chunksCulled = 0;
+	}
+
+	void cull(const VoxelGrid* grid, const glm::mat4& viewProj, glm::vec3 eye, std::vector<Chunk*>& visible) {
+		// filters visible (the frustum culler's output) in place; needs chunk->view from that same cull
+		gatherOccluders(grid, eye);
+		std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+		for (auto& box : occluders) {
+			rasterBox(viewProj, eye, box.lo, box.hi);
+		}
+		buildPyramid();
+
+		chunksTested = (int)visible.size();
+		int kept = 0;
+		for (auto chunk : visible) {
+			glm::vec3 lo = grid->chunkOrigin(chunk);
+			if (boxVisible(viewProj, lo, lo + (float)CHUNK_SIZE)) {
+				visible[kept++] = chunk;
+			}
+		}
+		visible.resize(kept);
+		chunksCulled = chunksTested - kept;
+	}
+
+	bool boxVisible(const glm::mat4& viewProj, glm::vec3 lo, glm::vec3 hi) {
+		float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 1.0f;
+		for (int c = 0; c < 8; c++) {
+			glm::vec4 clip = viewProj * glm::vec4((c & 1) ? hi.x : lo.x, (c & 2) ? hi.y : lo.y, (c & 4) ? hi.z : lo.z, 1.0f);
+			if (clip.w < NEAR_W) {
+				// crosses the eye plane, can't bound it on screen
+				return true;
+			}
+			glm::vec3 s = toScreen(clip);
+			minX = std::min(minX, s.x);
+			maxX = std::max(maxX, s.x);
+			minY = std::min(minY, s.y);
+			maxY = std::max(maxY, s.y);
+			nearest = std::min(nearest, s.z);
+		}
+		minX = std::max(minX, 0.0f);
+		minY = std::max(minY, 0.0f);
+		maxX = std::min(maxX, (float)(OCC_WIDTH - 1));
+		maxY = std::min(maxY, (float)(OCC_HEIGHT - 1));
+		if (minX > maxX || minY > maxY) {
+			return true;
+		}
+
+		int level = 0;
+		float extent = std::max(maxX - minX, maxY - minY);
+		while (extent > 2.0f && level + 1 < (int)levels.size()) {
+			extent *= 0.5f;
+			level++;
+		}
+		int x0 = (int)minX >> level;
+		int x1 = std::min((int)maxX >> level, levelWidth[level] - 1);
+		int y0 = (int)minY >> level;
+		int y1 = std::min((int)maxY >> level, levelHeight[level] - 1);
+		const std::vector<float>& depth = levels[level];
+		float farthest = 0.0f;
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				farthest = std::max(farthest, depth[y * levelWidth[level] + x]);
+			}
+		}
+		return nearest <= farthest;
+	}
+
+	const std::vector<float>& depthBuffer() const {
+		return levels[0];
+	}
+
+private:
+	class Occluder {
+	public:
+		glm::vec3 lo;
+		glm::vec3 hi;
+		float dist;
+	};
+
+	const float NEAR_W = 0.1f;
+
+	std::vector<Occluder> occluders;
+	// levels[0] is the depth buffer, each level after it the max of 2x2 texels
+	std::vector<std::vector<float>> levels;
+	std::vector<int> levelWidth;
+	std::vector<int> levelHeight;
+
+	void addOccluder(glm::vec3 lo, glm::vec3 hi, glm::vec3 eye) {
+		if ((int)occluders.size() == MAX_OCCLUDERS * 2) {
+			// keep only the nearest, so the list never outgrows what it reserved
+			keepNearest();
+		}
+		Occluder o;
+		o.lo = lo;
+		o.hi = hi;
+		glm::vec3 closest = glm::clamp(eye, lo, hi);
+		o.dist = glm::dot(closest - eye, closest - eye);
+		occluders.push_back(o);
+	}
+
+	void gatherOccluders(const VoxelGrid* grid, glm::vec3 eye) {
+		occluders.clear();
+		for (auto chunk : grid->chunks) {
+			// not only the drawn chunks: a buried chunk has no mesh but hides the most
+			if (chunk->view == NOLOAD || chunk->fullBricks == 0) {
+				continue;
+			}
+			glm::vec3 origin = grid->chunkOrigin(chunk);
+			if (chunk->fullBricks == ~0ull) {
+				addOccluder(origin, origin + (float)CHUNK_SIZE, eye);
+				continue;
+			}
+			uint64_t bricks = chunk->fullBricks;
+			while (bricks) {
+				int b = ctz64(bricks);
+				bricks &= bricks - 1;
+				int bz = b % BRICKS_PER_SIDE;
+				int by = (b / BRICKS_PER_SIDE) % BRICKS_PER_SIDE;
+				int bx = b / (BRICKS_PER_SIDE * BRICKS_PER_SIDE);
+				glm::vec3 lo = origin + glm::vec3(bx, by, bz) * (float)BRICK_SIZE;
+				addOccluder(lo, lo + (float)BRICK_SIZE, eye);
+			}
+		}
+		if ((int)occluders.size() > MAX_OCCLUDERS) {
+			keepNearest();
+		}
+		occludersDrawn = (int)occluders.size();
+	}
+
+	void keepNearest() {
+		std::nth_element(occluders.begin(), occluders.begin() + MAX_OCCLUDERS, occluders.end(),
+			[](const Occluder& a, const Occluder& b) { return a.dist < b.dist; });
+		occluders.resize(MAX_OCCLUDERS);
+	}
+
+	glm::vec3 toScreen(glm::vec4 clip) {
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		return glm::vec3((ndc.x * 0.5f + 0.5f) * OCC_WIDTH, (ndc.y * 0.5f + 0.5f) * OCC_HEIGHT, ndc.z * 0.5f + 0.5f);
+	}
+
+	void rasterBox(const glm::mat4& viewProj, glm::vec3 eye, glm::vec3 lo, glm::vec3 hi) {
+		/*
+			Writes one depth for the whole silhouette, the farthest corner of
+			the faces turned towards the eye. Depth is affine across each face,
+			so no point of the box's front is farther than that. Only pixels
+			entirely inside the silhouette are written. Together the buffer
+			never holds a depth nearer than what really covers a pixel, so
+			the test in boxVisible() can only err towards drawing.
+		*/
+		glm::vec3 s[8];
+		for (int c = 0; c < 8; c++) {
+			glm::vec4 clip = viewProj * glm::vec4((c & 1) ? hi.x : lo.x, (c & 2) ? hi.y : lo.y, (c & 4) ? hi.z : lo.z, 1.0f);
+			if (clip.w < NEAR_W) {
+				// would need clipping; dropping an occluder is always safe
+				return;
+			}
+			s[c] = toScreen(clip);
+		}
+		// corner index bits are x | y << 1 | z << 2; only faces turned towards the eye
+		const int faces[6][4] = {
+			{ 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+			{ 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+			{ 0, 1, 3, 2 }, { 4, 5, 7, 6 }
+		};
+		float z = 0.0f;
+		for (int f = 0; f < 6; f++) {
+			int axis = f / 2;
+			bool front = (f % 2 == 0) ? (eye[axis] < lo[axis]) : (eye[axis] > hi[axis]);
+			if (!front) {
+				continue;
+			}
+			for (int i = 0; i < 4; i++) {
+				z = std::max(z, s[faces[f][i]].z);
+			}
+		}
+		glm::vec2 hull[8];
+		int n = convexHull(s, hull);
+		if (n >= 3) {
+			rasterHull(hull, n, z);
+		}
+	}
+
+	static int convexHull(const glm::vec3* points, glm::vec2* hull) {
+		// monotone chain over the 8 projected corners, counter-clockwise
+		glm::vec2 p[8];
+		for (int i = 0; i < 8; i++) {
+			p[i] = glm::vec2(points[i]);
+		}
+		std::sort(p, p + 8, [](glm::vec2 a, glm::vec2 b) { return (a.x < b.x) || (a.x == b.x && a.y < b.y); });
+		glm::vec2 chain[16];
+		int k = 0;
+		for (int i = 0; i < 8; i++) {
+			while (k >= 2 && cross(chain[k - 2], chain[k - 1], p[i]) <= 0.0f) {
+				k--;
+			}
+			chain[k++] = p[i];
+		}
+		for (int i = 6, lower = k + 1; i >= 0; i--) {
+			while (k >= lower && cross(chain[k - 2], chain[k - 1], p[i]) <= 0.0f) {
+				k--;
+			}
+			chain[k++] = p[i];
+		}
+		// the last point repeats the first
+		int n = std::max(k - 1, 0);
+		std::copy(chain, chain + n, hull);
+		return n;
+	}
+
+	static float cross(glm::vec2 o, glm::vec2 a, glm::vec2 b) {
+		return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+	}
+
+	void rasterHull(const glm::vec2* hull, int n, float z) {
+		float minX = hull[0].x, maxX = hull[0].x, minY = hull[0].y, maxY = hull[0].y;
+		for (int i = 1; i < n; i++) {
+			minX = std::min(minX, hull[i].x);
+			maxX = std::max(maxX, hull[i].x);
+			minY = std::min(minY, hull[i].y);
+			maxY = std::max(maxY, hull[i].y);
+		}
+		int x0 = std::max((int)std::floor(minX), 0);
+		int x1 = std::min((int)std::ceil(maxX), OCC_WIDTH - 1);
+		int y0 = std::max((int)std::floor(minY), 0);
+		int y1 = std::min((int)std::ceil(maxY), OCC_HEIGHT - 1);
+		if (x0 > x1 || y0 > y1) {
+			return;
+		}
+		x0 &= ~3;
+
+		// e(p) = A * x + B * y + C, >= 0 inside; C is moved in by half a pixel
+		// along the edge normal, so >= 0 at a centre means the whole pixel is inside
+		float A[8], B[8], C[8];
+		for (int i = 0; i < n; i++) {
+			glm::vec2 a = hull[i];
+			glm::vec2 b = hull[(i + 1) % n];
+			A[i] = a.y - b.y;
+			B[i] = b.x - a.x;
+			C[i] = (b.y - a.y) * a.x - (b.x - a.x) * a.y - 0.5f * (std::fabs(A[i]) + std::fabs(B[i]));
+		}
+
+		float* depth = levels[0].data();
+#ifdef OCCLUSION_SSE
+		__m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		__m128 zero = _mm_setzero_ps();
+		__m128 z4 = _mm_set1_ps(z);
+		for (int y = y0; y <= y1; y++) {
+			float py = y + 0.5f;
+			for (int x = x0; x <= x1; x += 4) {
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+				__m128 inside = _mm_cmpeq_ps(zero, zero);
+				for (int i = 0; i < n; i++) {
+					__m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[i]), px), _mm_set1_ps(B[i] * py + C[i]));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(e, zero));
+				}
+				if (_mm_movemask_ps(inside) == 0) {
+					continue;
+				}
+				float* dst = depth + y * OCC_WIDTH + x;
+				__m128 cur = _mm_loadu_ps(dst);
+				__m128 closer = _mm_min_ps(cur, z4);
+				_mm_storeu_ps(dst, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, cur)));
+			}
+		}
+#else
+		for (int y = y0; y <= y1; y++) {
+			float py = y + 0.5f;
+			for (int x = x0; x <= x1; x++) {
+				float px = x + 0.5f;
+				bool inside = true;
+				for (int i = 0; i < n && inside; i++) {
+					inside = (A[i] * px + B[i] * py + C[i] >= 0);
+				}
+				if (inside) {
+					float& dst = depth[y * OCC_WIDTH + x];
+					dst = std::min(dst, z);
+				}
+			}
+		}
+#endif
+	}
+
+	void buildPyramid() {
+		for (size_t l = 1; l < levels.size(); l++) {
+			const std::vector<float>& src = levels[l - 1];
+			std::vector<float>& dst = levels[l];
+			int sw = levelWidth[l - 1];
+			int sh = levelHeight[l - 1];
+			for (int y = 0; y < levelHeight[l]; y++) {
+				int y0 = std::min(y * 2, sh - 1);
+				int y1 = std::min(y * 2 + 1, sh - 1);
+				for (int x = 0; x < levelWidth[l]; x++) {
+					int x0 = std::min(x * 2, sw - 1);
+					int x1 = std::min(x * 2 + 1, sw - 1);
+					dst[y * levelWidth[l] + x] = std::max(std::max(src[y0 * sw + x0], src[y0 * sw + x1]),
+						std::max(src[y1 * sw + x0], src[y1 * sw + x1]));
+				}
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "chunk.h"
+#include "jobs.h"
+#include "lsystem.h"
+#include "memory.h"
+#include "mesher.h"
+#include "pvs.h"
+
+class PipelineStage {
+public:
+	std::string name;
+	double ms;
+};
+
+class HeadlessPipeline {
+public:
+	/*
+		Headless pipeline
+		---------------------
+		parse -> rewrite -> carve -> cubes -> voxelize -> mesh -> visibility -> write
+		---------------------
+		Everything the windowed path does before its first frame, with no
+		window or GL context. The results are written next to each other:
+			<out>.vox    "CVOX", size, then size^3 materials in x, y, z order
+			<out>.mesh   "CMSH", mode, chunk count, then per chunk its coord,
+			             vertex count and packed vertices (see mesher.h)
+			<out>.pvs    CavePVS cache
+			<out>.txt    stage timings, counts and memory
+	*/
+	std::vector<PipelineStage> stages;
+	int cubeCount;
+	int meshedChunks;
+	long long triangles;
+
+	HeadlessPipeline(JobSystem* j, meshMode m) {
+		jobs = j;
+		mode = m;
+		cubeCount = 0;
+		meshedChunks = 0;
+		triangles = 0;
+	}
+
+	int run(const std::string& modelPath, const std::string& out) {
+		LSystem lsystem(modelPath);
+		lsystem.verbose = false;
+		lsystem.parseFile();
+		stages.push_back({ "parse", lsystem.parseMs });
+		stages.push_back({ "rewrite", lsystem.rewriteMs });
+		stages.push_back({ "carve", lsystem.carveMs });
+
+		auto start = std::chrono::steady_clock::now();
+		cubeCount = (int)lsystem.writeCubes(jobs).size();
+		lap("cubes", start);
+
+		VoxelGrid grid(lsystem.matrix, lsystem.numCubes, jobs);
+		lap("voxelize", start);
+
+		std::vector<std::vector<packedVertex>> meshes(grid.chunks.size());
+		jobs->parallelForEach((int)grid.chunks.size(), [&](int i) {
+			static thread_local Mesher mesher;
+			mesher.mode = mode;
+			mesher.mesh(&grid, grid.chunks[i], meshes[i]);
+		});
+		for (auto& vertices : meshes) {
+			meshedChunks += vertices.empty() ? 0 : 1;
+			triangles += vertices.size() / 3;
+			MemoryTracker::get().add(MEM_MESHES, vertices.capacity() * sizeof(packedVertex));
+		}
+		lap("mesh", start);
+
+		CavePVS pvs;
+		pvs.build(&grid, jobs);
+		lap("visibility", start);
+
+		bool written = writeGrid(grid, out + ".vox") && writeMeshes(grid, meshes, out + ".mesh");
+		pvs.save(&grid, out + ".pvs");
+		lap("write", start);
+
+		for (auto& vertices : meshes) {
+			MemoryTracker::get().release(MEM_MESHES, vertices.capacity() * sizeof(packedVertex));
+		}
+		lsystem.clearCubes();
+		report(std::cout);
+		std::ofstream summary(out + ".txt");
+		report(summary);
+		return written ? 0 : -1;
+	}
+
+	void report(std::ostream& os) const {
+		double total = 0.0;
+		for (auto& stage : stages) {
+			os << std::left << std::setw(12) << stage.name << std::right << std::fixed << std::setprecision(2)
+				<< std::setw(10) << stage.ms << " ms" << std::endl;
+			total += stage.ms;
+		}
+		os << std::left << std::setw(12) << "total" << std::right << std::setw(10) << total << " ms" << std::endl;
+		os << cubeCount << " cubes, " << meshedChunks << " meshed chunks, " << triangles << " triangles ("
+			<< ((mode == GREEDY) ? "greedy" : "culled") << ")" << std::endl;
+		MemoryTracker::get().report(os);
+	}
+
+private:
+	JobSystem* jobs;
+	meshMode mode;
+
+	void lap(const char* name, std::chrono::steady_clock::time_point& start) {
+		auto now = std::chrono::steady_clock::now();
+		stages.push_back({ name, std::chrono::duration<double, std::milli>(now - start).count() });
+		MemoryTracker::get().stage(name);
+		start = std::chrono::steady_clock::now();
+	}
+
+	bool writeGrid(const VoxelGrid& grid, const std::string& path) {
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			std::cerr << "Failed to open " << path << std::endl;
+			return false;
+		}
+		file.write("CVOX", 4);
+		file.write((const char*)&grid.size, sizeof(int));
+		std::vector<unsigned char> row(grid.size);
+		for (int x = 0; x < grid.size; x++) {
+			for (int y = 0; y < grid.size; y++) {
+				for (int z = 0; z < grid.size; z++) {
+					row[z] = grid.getVoxel(x, y, z);
+				}
+				file.write((const char*)row.data(), row.size());
+			}
+		}
+		return (bool)file;
+	}
+
+	bool writeMeshes(const VoxelGrid& grid, const std::vector<std::vector<packedVertex>>& meshes, const std::string& path) {
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			std::cerr << "Failed to open " << path << std::endl;
+			return false;
+		}
+		int modeId = (int)mode;
+		file.write("CMSH", 4);
+		file.write((const char*)&modeId, sizeof(int));
+		file.write((const char*)&meshedChunks, sizeof(int));
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (meshes[i].empty()) {
+				continue;
+			}
+			int count = (int)meshes[i].size();
+			file.write((const char*)&grid.chunks[i]->coord, sizeof(glm::ivec3));
+			file.write((const char*)&count, sizeof(int));
+			file.write((const char*)meshes[i].data(), meshes[i].size() * sizeof(packedVertex));
+		}
+		return (bool)file;
+	}
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+	Minimal PNG output
+	---------------------
+	8-bit RGB, no filtering, and the zlib stream uses stored (uncompressed)
+	deflate blocks. Files are about as big as the raw pixels, but any
+	viewer reads them and there is no library to ship.
+	---------------------
+*/
+
+inline uint32_t pngCrc(const unsigned char* data, size_t bytes, uint32_t crc = 0xffffffffu) {
+	static uint32_t table[256];
+	static bool ready = false;
+	if (!ready) {
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) {
+				c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+			}
+			table[n] = c;
+		}
+		ready = true;
+	}
+	for (size_t i = 0; i < bytes; i++) {
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+inline void pngPut32(std::vector<unsigned char>& out, uint32_t v) {
+	out.push_back((unsigned char)(v >> 24));
+	out.push_back((unsigned char)(v >> 16));
+	out.push_back((unsigned char)(v >> 8));
+	out.push_back((unsigned char)v);
+}
+
+inline void pngChunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data) {
+	std::vector<unsigned char> body(type, type + 4);
+	body.insert(body.end(), data.begin(), data.end());
+	std::vector<unsigned char> header;
+	pngPut32(header, (uint32_t)data.size());
+	std::vector<unsigned char> crc;
+	pngPut32(crc, pngCrc(body.data(), body.size()) ^ 0xffffffffu);
+	file.write((const char*)header.data(), header.size());
+	file.write((const char*)body.data(), body.size());
+	file.write((const char*)crc.data(), crc.size());
+}
+
+inline bool writePNG(const std::string& path, int width, int height, const std::vector<unsigned char>& rgb) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Failed to open " << path << std::endl;
+		return false;
+	}
+
+	// every row starts with its filter type, 0 = none
+	size_t stride = (size_t)width * 3;
+	std::vector<unsigned char> raw;
+	raw.reserve((stride + 1) * height);
+	for (int y = 0; y < height; y++) {
+		raw.push_back(0);
+		raw.insert(raw.end(), rgb.begin() + y * stride, rgb.begin() + (y + 1) * stride);
+	}
+
+	std::vector<unsigned char> zlib = { 0x78, 0x01 };
+	const size_t BLOCK = 65535;
+	for (size_t at = 0; at < raw.size() || at == 0; at += BLOCK) {
+		size_t len = std::min(BLOCK, raw.size() - at);
+		bool last = at + len >= raw.size();
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back((unsigned char)len);
+		zlib.push_back((unsigned char)(len >> 8));
+		zlib.push_back((unsigned char)~len);
+		zlib.push_back((unsigned char)(~len >> 8));
+		zlib.insert(zlib.end(), raw.begin() + at, raw.begin() + at + len);
+		if (last) {
+			break;
+		}
+	}
+	uint32_t a = 1, b = 0;
+	for (auto byte : raw) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	pngPut32(zlib, (b << 16) | a);
+
+	std::vector<unsigned char> ihdr;
+	pngPut32(ihdr, (uint32_t)width);
+	pngPut32(ihdr, (uint32_t)height);
+	// 8 bits per channel, RGB, deflate, no filter method extensions, no interlace
+	unsigned char format[5] = { 8, 2, 0, 0, 0 };
+	ihdr.insert(ihdr.end(), format, format + 5);
+
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	file.write((const char*)signature, 8);
+	pngChunk(file, "IHDR", ihdr);
+	pngChunk(file, "IDAT", zlib);
+	pngChunk(file, "IEND", std::vector<unsigned char>());
+	return (bool)file;
+}
+
+#endif
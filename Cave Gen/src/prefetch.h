@@ -0,0 +1,168 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <glm/glm.hpp>
+
+// camera samples the velocity is taken over
+const int PREFETCH_SAMPLES = 16;
+// seconds between predicted points, and the most points in one path
+const float PREFETCH_STEP = 0.25f;
+const int PREFETCH_MAX_POINTS = 64;
+// slower than this, in voxels per second, counts as standing still
+const float PREFETCH_MIN_SPEED = 0.5f;
+// a single step longer than this is a teleport, not movement
+const float PREFETCH_MAX_STEP = 64.0f;
+
+class PredictedPath {
+public:
+	int count;
+	float speed;
+	glm::vec3 points[PREFETCH_MAX_POINTS];
+	// direction of travel at each point
+	glm::vec3 dirs[PREFETCH_MAX_POINTS];
+	// seconds from now
+	float times[PREFETCH_MAX_POINTS];
+};
+
+class CameraTrajectory {
+public:
+	/*
+		Trajectory prediction
+		---------------------
+		Keeps the last PREFETCH_SAMPLES camera positions and view
+		directions. The velocity is the displacement across that window
+		divided by its duration, so one jittery frame barely moves it.
+		The turn rate is the change in view yaw over the same window.
+		predict() runs both forward: the direction of travel turns at the
+		turn rate while the speed stays constant. That follows a player
+		sprinting round a bend in a tunnel, not only a straight line.
+		---------------------
+		All storage is fixed-size, so sampling every frame allocates
+		nothing.
+	*/
+	CameraTrajectory() {
+		reset();
+	}
+
+	void reset() {
+		count = 0;
+		next = 0;
+		clock = 0.0f;
+	}
+
+	void sample(glm::vec3 pos, glm::vec3 front, float dt) {
+		if (count > 0 && glm::length(pos - newest().pos) > PREFETCH_MAX_STEP) {
+			reset();
+		}
+		clock += dt;
+		samples[next] = { clock, pos, yawOf(front) };
+		next = (next + 1) % PREFETCH_SAMPLES;
+		count = std::min(count + 1, PREFETCH_SAMPLES);
+	}
+
+	glm::vec3 velocity() const {
+		float span = newest().time - oldest().time;
+		if (count < 2 || span <= 0.0f) {
+			return glm::vec3(0.0f);
+		}
+		return (newest().pos - oldest().pos) / span;
+	}
+
+	glm::vec3 position() const {
+		return (count > 0) ? newest().pos : glm::vec3(0.0f);
+	}
+
+	float turnRate() const {
+		// radians per second about world up
+		float span = newest().time - oldest().time;
+		if (count < 2 || span <= 0.0f) {
+			return 0.0f;
+		}
+		float turn = newest().yaw - oldest().yaw;
+		turn = std::atan2(std::sin(turn), std::cos(turn));
+		return turn / span;
+	}
+
+	void predict(float seconds, PredictedPath& path) const {
+		path.count = 0;
+		glm::vec3 v = velocity();
+		path.speed = glm::length(v);
+		if (path.speed < PREFETCH_MIN_SPEED) {
+			return;
+		}
+		glm::vec3 pos = newest().pos;
+		glm::vec3 dir = v / path.speed;
+		float step = std::max(PREFETCH_STEP, seconds / PREFETCH_MAX_POINTS);
+		float c = std::cos(turnRate() * step);
+		float s = std::sin(turnRate() * step);
+		for (float t = step; t <= seconds + 1e-4f && path.count < PREFETCH_MAX_POINTS; t += step) {
+			pos += dir * path.speed * step;
+			// turn by the same yaw convention as Camera::Front
+			dir = glm::vec3(c * dir.x - s * dir.z, dir.y, s * dir.x + c * dir.z);
+			path.points[path.count] = pos;
+			path.dirs[path.count] = dir;
+			path.times[path.count] = t;
+			path.count++;
+		}
+	}
+
+private:
+	class Sample {
+	public:
+		float time;
+		glm::vec3 pos;
+		float yaw;
+	};
+
+	Sample samples[PREFETCH_SAMPLES];
+	int count;
+	int next;
+	float clock;
+
+	const Sample& newest() const {
+		return samples[(next + PREFETCH_SAMPLES - 1) % PREFETCH_SAMPLES];
+	}
+
+	const Sample& oldest() const {
+		return samples[(count < PREFETCH_SAMPLES) ? 0 : next];
+	}
+
+	static float yawOf(glm::vec3 front) {
+		return std::atan2(front.z, front.x);
+	}
+};
+
+class PrefetchStats {
+public:
+	// chunks entering view range that were already drawable, and those that weren't
+	long long hits;
+	long long misses;
+	// chunks generated for the predicted path rather than the current position
+	long long prefetched;
+	// prefetched chunks unloaded without ever coming into view range
+	long long wasted;
+
+	PrefetchStats() {
+		hits = 0;
+		misses = 0;
+		prefetched = 0;
+		wasted = 0;
+	}
+
+	float hitRate() const {
+		long long total = hits + misses;
+		return (total > 0) ? (float)hits / total : 1.0f;
+	}
+
+	void report(std::ostream& os) const {
+		os << "prefetch: " << hits << " hits, " << misses << " misses (" << std::fixed << std::setprecision(1)
+			<< hitRate() * 100.0f << "% hit rate), " << prefetched << " prefetched, " << wasted << " wasted" << std::endl;
+		os.unsetf(std::ios::floatfield);
+	}
+};
+
+#endif
@@ -0,0 +1,458 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "shader.h"
+
+typedef enum framePhase {
+	PHASE_INPUT,
+	PHASE_UPDATE,
+	PHASE_CULLING,
+	PHASE_UNIFORMS,
+	PHASE_DRAW,
+	PHASE_SWAP,
+	PHASE_COUNT
+} framePhase;
+
+typedef enum gpuPass {
+	PASS_SCENE,
+	PASS_OVERLAY,
+	PASS_COUNT
+} gpuPass;
+
+// frames the percentiles are taken over
+const int HISTORY_FRAMES = 600;
+const float HISTOGRAM_BUCKET_MS = 0.1f;
+// 0.1 ms buckets up to 100 ms, slower frames share the last one
+const int HISTOGRAM_BUCKETS = 1000;
+// frames of timer queries in flight before results are read back
+const int QUERY_LATENCY = 4;
+
+class FrameRecord {
+public:
+	long long frame;
+	double frameMs;
+	double cpuMs[PHASE_COUNT];
+	// -1 when the result wasn't back in time
+	double gpuMs[PASS_COUNT];
+	// set by the renderer through count() before endFrame()
+	int drawCalls;
+	int chunksDrawn;
+	int frustumCulled;
+	int pvsCulled;
+	int occlusionCulled;
+};
+
+class FrameTotals {
+public:
+	// everything since the profiler was created, not just the history window
+	long long frames;
+	double frameMs;
+	double worstMs;
+	long long gpuFrames;
+	double gpuMs;
+	long long drawCalls;
+	long long chunksDrawn;
+	long long chunksCulled;
+};
+
+class FrameProfiler {
+public:
+	/*
+		CPU phases are timed with a steady clock; a phase may be entered
+		several times per frame and adds up. GPU passes use GL_TIME_ELAPSED
+		queries, one set per frame in a ring of QUERY_LATENCY. A frame's
+		results are only read once GL_QUERY_RESULT_AVAILABLE says so, so the
+		CPU never waits on the GPU; a frame whose queries are still busy
+		when its slot comes round again is recorded without GPU times.
+		Finished frames go into the rolling histogram, the overlay's recent
+		list and the CSV file, in frame order.
+	*/
+	// finished frames, oldest first, at most HISTORY_FRAMES
+	std::vector<FrameRecord> recent;
+
+	// without gpuTiming no GL is touched, for headless runs
+	FrameProfiler(bool gpuTiming = true) {
+		gpu = gpuTiming;
+		if (gpu) {
+			glGenQueries(QUERY_LATENCY * PASS_COUNT, &queries[0][0]);
+		}
+		for (int s = 0; s < QUERY_LATENCY; s++) {
+			pending[s] = false;
+			for (int p = 0; p < PASS_COUNT; p++) {
+				used[s][p] = false;
+			}
+		}
+		frame = 0;
+		oldest = 0;
+		historyCount = 0;
+		historyNext = 0;
+		history.assign(HISTORY_FRAMES, 0.0);
+		buckets.assign(HISTOGRAM_BUCKETS, 0);
+		recent.reserve(HISTORY_FRAMES);
+		runBuckets.assign(HISTOGRAM_BUCKETS, 0);
+		totals = FrameTotals();
+		summaryText[0] = '\0';
+	}
+
+	bool openCsv(const std::string& path) {
+		csv.open(path);
+		if (!csv.is_open()) {
+			std::cerr << "Failed to open " << path << std::endl;
+			return false;
+		}
+		csv << "frame,frame_ms,input_ms,update_ms,culling_ms,uniforms_ms,draw_ms,swap_ms,gpu_scene_ms,gpu_overlay_ms,"
+			<< "draw_calls,chunks_drawn,frustum_culled,pvs_culled,occlusion_culled" << std::endl;
+		return true;
+	}
+
+	void beginFrame() {
+		int slot = (int)(frame % QUERY_LATENCY);
+		if (pending[slot]) {
+			// still busy after QUERY_LATENCY frames, give up on its GPU times
+			finish(slot, false);
+		}
+		FrameRecord& r = records[slot];
+		r.frame = frame;
+		for (int p = 0; p < PHASE_COUNT; p++) {
+			r.cpuMs[p] = 0.0;
+		}
+		for (int p = 0; p < PASS_COUNT; p++) {
+			r.gpuMs[p] = -1.0;
+			used[slot][p] = false;
+		}
+		count(0, 0, 0, 0, 0);
+		frameStart = std::chrono::steady_clock::now();
+	}
+
+	void beginPhase(framePhase phase) {
+		phaseStart[phase] = std::chrono::steady_clock::now();
+	}
+
+	void endPhase(framePhase phase) {
+		records[frame % QUERY_LATENCY].cpuMs[phase] += since(phaseStart[phase]);
+	}
+
+	void addPhase(framePhase phase, double ms) {
+		// for a phase timed somewhere else, e.g. on the simulation thread
+		records[frame % QUERY_LATENCY].cpuMs[phase] += ms;
+	}
+
+	void beginPass(gpuPass pass) {
+		// passes can't nest, GL allows one GL_TIME_ELAPSED query at a time
+		if (!gpu) {
+			return;
+		}
+		int slot = (int)(frame % QUERY_LATENCY);
+		glBeginQuery(GL_TIME_ELAPSED, queries[slot][pass]);
+		used[slot][pass] = true;
+	}
+
+	void endPass() {
+		if (gpu) {
+			glEndQuery(GL_TIME_ELAPSED);
+		}
+	}
+
+	void count(int drawCalls, int chunksDrawn, int frustumCulled, int pvsCulled, int occlusionCulled) {
+		FrameRecord& r = records[frame % QUERY_LATENCY];
+		r.drawCalls = drawCalls;
+		r.chunksDrawn = chunksDrawn;
+		r.frustumCulled = frustumCulled;
+		r.pvsCulled = pvsCulled;
+		r.occlusionCulled = occlusionCulled;
+	}
+
+	void endFrame() {
+		int slot = (int)(frame % QUERY_LATENCY);
+		records[slot].frameMs = since(frameStart);
+		pending[slot] = true;
+		frame++;
+
+		// collect whatever is ready, oldest first, without blocking
+		while (oldest < frame) {
+			int s = (int)(oldest % QUERY_LATENCY);
+			if (!pending[s] || !resultsReady(s)) {
+				break;
+			}
+			finish(s, true);
+		}
+	}
+
+	void flush() {
+		// waits for the frames still in flight, for the end of a run
+		while (oldest < frame) {
+			int s = (int)(oldest % QUERY_LATENCY);
+			if (!pending[s]) {
+				oldest++;
+				continue;
+			}
+			finish(s, true);
+		}
+	}
+
+	double percentile(float p) const {
+		return percentileOf(buckets, historyCount, p);
+	}
+
+	// over every frame so far
+	double runPercentile(float p) const {
+		return percentileOf(runBuckets, totals.frames, p);
+	}
+
+	void report(std::ostream& os) const {
+		const FrameTotals& t = totals;
+		if (t.frames == 0) {
+			return;
+		}
+		os.precision(3);
+		os << t.frames << " frames, cpu mean " << t.frameMs / t.frames << " ms, p50 " << runPercentile(0.5f) << " ms, p95 "
+			<< runPercentile(0.95f) << " ms, p99 " << runPercentile(0.99f) << " ms, worst " << t.worstMs << " ms" << std::endl;
+		if (t.gpuFrames > 0) {
+			os << "gpu scene mean " << t.gpuMs / t.gpuFrames << " ms over " << t.gpuFrames << " frames" << std::endl;
+		}
+		os << "per frame: " << (double)t.drawCalls / t.frames << " draw calls, " << (double)t.chunksDrawn / t.frames
+			<< " chunks drawn, " << (double)t.chunksCulled / t.frames << " chunks culled" << std::endl;
+	}
+
+	long long frameNumber() const {
+		return frame;
+	}
+
+	const FrameTotals& runTotals() const {
+		return totals;
+	}
+
+	const char* summary() {
+		// formatted in place, it is called from inside the frame loop
+		int n = snprintf(summaryText, sizeof(summaryText), "p50 %.3g ms | p95 %.3g ms | p99 %.3g ms",
+			percentile(0.5f), percentile(0.95f), percentile(0.99f));
+		if (!recent.empty() && recent.back().gpuMs[PASS_SCENE] >= 0.0) {
+			snprintf(summaryText + n, sizeof(summaryText) - n, " | gpu %.3g ms", recent.back().gpuMs[PASS_SCENE]);
+		}
+		return summaryText;
+	}
+
+private:
+	bool gpu;
+	unsigned int queries[QUERY_LATENCY][PASS_COUNT];
+	bool used[QUERY_LATENCY][PASS_COUNT];
+	bool pending[QUERY_LATENCY];
+	FrameRecord records[QUERY_LATENCY];
+	long long frame;
+	// next frame to be finished
+	long long oldest;
+	std::chrono::steady_clock::time_point frameStart;
+	std::chrono::steady_clock::time_point phaseStart[PHASE_COUNT];
+
+	// ring of the last HISTORY_FRAMES frame times and their bucket counts
+	std::vector<double> history;
+	std::vector<int> buckets;
+	int historyCount;
+	int historyNext;
+	std::vector<int> runBuckets;
+	FrameTotals totals;
+	std::ofstream csv;
+	char summaryText[128];
+
+	static double since(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	static double percentileOf(const std::vector<int>& counts, long long total, float p) {
+		// from the bucket counts, so to within HISTOGRAM_BUCKET_MS
+		if (total == 0) {
+			return 0.0;
+		}
+		long long target = (long long)(p * total);
+		long long seen = 0;
+		for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+			seen += counts[b];
+			if (seen > target) {
+				return (b + 0.5) * HISTOGRAM_BUCKET_MS;
+			}
+		}
+		return HISTOGRAM_BUCKETS * HISTOGRAM_BUCKET_MS;
+	}
+
+	static int bucketOf(double ms) {
+		int b = (int)(ms / HISTOGRAM_BUCKET_MS);
+		return (b < HISTOGRAM_BUCKETS) ? b : HISTOGRAM_BUCKETS - 1;
+	}
+
+	bool resultsReady(int slot) {
+		for (int p = 0; p < PASS_COUNT; p++) {
+			if (!used[slot][p]) {
+				continue;
+			}
+			int available = 0;
+			glGetQueryObjectiv(queries[slot][p], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void finish(int slot, bool withGpu) {
+		FrameRecord& r = records[slot];
+		if (withGpu) {
+			for (int p = 0; p < PASS_COUNT; p++) {
+				if (used[slot][p]) {
+					GLuint64 ns = 0;
+					glGetQueryObjectui64v(queries[slot][p], GL_QUERY_RESULT, &ns);
+					r.gpuMs[p] = ns / 1e6;
+				}
+			}
+		}
+		pending[slot] = false;
+		oldest = r.frame + 1;
+
+		if (historyCount == HISTORY_FRAMES) {
+			buckets[bucketOf(history[historyNext])]--;
+		}
+		else {
+			historyCount++;
+		}
+		history[historyNext] = r.frameMs;
+		buckets[bucketOf(r.frameMs)]++;
+		historyNext = (historyNext + 1) % HISTORY_FRAMES;
+
+		runBuckets[bucketOf(r.frameMs)]++;
+		totals.frames++;
+		totals.frameMs += r.frameMs;
+		totals.worstMs = std::max(totals.worstMs, r.frameMs);
+		if (r.gpuMs[PASS_SCENE] >= 0.0) {
+			totals.gpuFrames++;
+			totals.gpuMs += r.gpuMs[PASS_SCENE];
+		}
+		totals.drawCalls += r.drawCalls;
+		totals.chunksDrawn += r.chunksDrawn;
+		totals.chunksCulled += r.frustumCulled + r.pvsCulled + r.occlusionCulled;
+
+		if ((int)recent.size() == HISTORY_FRAMES) {
+			recent.erase(recent.begin());
+		}
+		recent.push_back(r);
+
+		if (csv.is_open()) {
+			csv << r.frame << "," << r.frameMs;
+			for (int p = 0; p < PHASE_COUNT; p++) {
+				csv << "," << r.cpuMs[p];
+			}
+			for (int p = 0; p < PASS_COUNT; p++) {
+				csv << "," << r.gpuMs[p];
+			}
+			csv << "," << r.drawCalls << "," << r.chunksDrawn << "," << r.frustumCulled << "," << r.pvsCulled << "," << r.occlusionCulled << "\n";
+		}
+	}
+};
+
+class ScopedTimer {
+public:
+	ScopedTimer(FrameProfiler& p, framePhase ph) : profiler(p), phase(ph) {
+		profiler.beginPhase(phase);
+	}
+
+	~ScopedTimer() {
+		profiler.endPhase(phase);
+	}
+
+private:
+	FrameProfiler& profiler;
+	framePhase phase;
+};
+
+// frames shown by the overlay graph, one column of OVERLAY_COLUMN pixels each
+const int OVERLAY_FRAMES = 240;
+const int OVERLAY_COLUMN = 2;
+// graph height in pixels for a 33.3 ms frame
+const float OVERLAY_HEIGHT = 160.0f;
+const UniformHandle SCREEN_UNIFORM("screen");
+
+class ProfilerOverlay {
+public:
+	/*
+		Frame-time graph in the bottom-left corner: one stacked column per
+		frame with a colour per CPU phase, a white tick at the GPU scene
+		time and lines at 16.7 and 33.3 ms. The numbers (p50/p95/p99) go in
+		the window title, there is no text rendering.
+	*/
+	ProfilerOverlay() : shader("shaders/overlay_v.glsl", "shaders/overlay_f.glsl") {
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(2 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+		glBindVertexArray(0);
+		// a column of quads per frame plus the two target lines, 6 vertices of 5 floats each
+		vertices.reserve((OVERLAY_FRAMES * (PHASE_COUNT + 1) + 2) * 30);
+	}
+
+	void draw(const FrameProfiler& profiler, int width, int height) {
+		static const glm::vec3 colours[PHASE_COUNT] = {
+			glm::vec3(0.4f, 0.4f, 0.4f), glm::vec3(0.9f, 0.6f, 0.1f), glm::vec3(0.2f, 0.8f, 0.3f),
+			glm::vec3(0.3f, 0.6f, 1.0f), glm::vec3(0.9f, 0.2f, 0.3f), glm::vec3(0.6f, 0.3f, 0.8f)
+		};
+		float scale = OVERLAY_HEIGHT / 33.3f;
+		float left = 8.0f;
+		float bottom = 8.0f;
+		vertices.clear();
+
+		int first = std::max(0, (int)profiler.recent.size() - OVERLAY_FRAMES);
+		for (int i = first; i < (int)profiler.recent.size(); i++) {
+			const FrameRecord& r = profiler.recent[i];
+			float x = left + (i - first) * OVERLAY_COLUMN;
+			float y = bottom;
+			for (int p = 0; p < PHASE_COUNT; p++) {
+				float h = (float)r.cpuMs[p] * scale;
+				quad(x, y, OVERLAY_COLUMN, h, colours[p]);
+				y += h;
+			}
+			if (r.gpuMs[PASS_SCENE] >= 0.0) {
+				quad(x, bottom + (float)r.gpuMs[PASS_SCENE] * scale, OVERLAY_COLUMN, 1.0f, glm::vec3(1.0f));
+			}
+		}
+		quad(left, bottom + 16.7f * scale, OVERLAY_FRAMES * OVERLAY_COLUMN, 1.0f, glm::vec3(0.2f, 1.0f, 0.2f));
+		quad(left, bottom + 33.3f * scale, OVERLAY_FRAMES * OVERLAY_COLUMN, 1.0f, glm::vec3(1.0f, 0.2f, 0.2f));
+
+		glDisable(GL_DEPTH_TEST);
+		shader.use();
+		shader.setVec3(SCREEN_UNIFORM, glm::vec3((float)width, (float)height, 0.0f));
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STREAM_DRAW);
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(vertices.size() / 5));
+		glBindVertexArray(0);
+		glEnable(GL_DEPTH_TEST);
+	}
+
+private:
+	Shader shader;
+	unsigned int VAO;
+	unsigned int VBO;
+	// x, y in pixels from the bottom left, then r, g, b
+	std::vector<float> vertices;
+
+	void quad(float x, float y, float w, float h, glm::vec3 c) {
+		const float corners[6][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 0 }, { 1, 1 }, { 0, 1 } };
+		for (auto& k : corners) {
+			float v[5] = { x + k[0] * w, y + k[1] * h, c.r, c.g, c.b };
+			vertices.insert(vertices.end(), v, v + 5);
+		}
+	}
+};
+
+#endif
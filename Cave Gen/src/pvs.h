@@ -0,0 +1,809 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "chunk.h"
+#include "jobs.h"
+#include "tracer.h"
+
+// furthest a cell reaches from its seed along any axis, in voxels
+const int PVS_CELL_EXTENT = 16;
+// neighbouring cells whose shared saddle is within this of the shallower peak are one chamber
+const int PVS_MERGE_DEPTH = 1;
+const int PVS_CELL_SAMPLES = 16;
+const int PVS_PORTAL_SAMPLES = 9;
+const uint32_t PVS_MAGIC = 0x32535650; // "PVS2"
+const unsigned short NO_CELL = 0xffff;
+
+class CavePVS {
+public:
+	/*
+		Potentially visible sets
+		---------------------
+		1. Every air voxel gets its distance to the nearest rock; the grid
+		   border counts as rock.
+		2. Watershed: air is flooded from the deepest voxels down, so cells
+		   grow out of chamber centres and meet at the narrowest points of the
+		   tunnels between them. A cell also stops PVS_CELL_EXTENT voxels from
+		   its seed, which cuts long tunnels into pieces.
+		3. Neighbouring cells without a real constriction between them are
+		   merged again.
+		4. Touching cells share a portal.
+		5. From each cell, portals are followed outwards as long as a straight
+		   line through air joins one of the cell's sample points to a sample
+		   point on the portal. Every cell reached is visible, and with it the
+		   chunks holding rock faces that look into it.
+		6. Sampled sight lines can miss a narrow gap, so each set is
+		   widened by the sets of the cells across its portals and by the
+		   chunks the portals pass through. A miss then has to get past a
+		   whole extra cell before anything pops out.
+		---------------------
+		The sets only depend on the voxels, so they are cached on disk keyed
+		by a hash of them. Editing voxels makes them stale; invalidate() turns
+		them off until the next build, which PVSRebuilder runs in the
+		background.
+	*/
+	int numCells;
+	int numPortals;
+	bool valid;
+
+	CavePVS() {
+		numCells = 0;
+		numPortals = 0;
+		valid = false;
+		size = 0;
+		chunksPerSide = 0;
+		chunkWords = 0;
+	}
+
+	void loadOrBuild(const VoxelGrid* grid, JobSystem* jobs, const std::string& path) {
+		auto start = std::chrono::steady_clock::now();
+		bool loaded = load(grid, path);
+		if (!loaded) {
+			build(grid, jobs);
+			save(grid, path);
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << (loaded ? "Loaded" : "Built") << " PVS: " << numCells << " cells, " << numPortals << " portals, "
+			<< averageChunks() << " chunks per set in " << ms << " ms" << std::endl;
+	}
+
+	void build(const VoxelGrid* grid, JobSystem* jobs = NULL) {
+		TRACE_ZONE("CavePVS::build");
+		size = grid->size;
+		chunksPerSide = grid->chunksPerSide;
+		chunkWords = ((int)grid->chunks.size() + 63) / 64;
+		computeDistances(grid);
+		watershed();
+		mergeCells();
+		findPortals();
+		solve(jobs);
+		dist.clear();
+		dist.shrink_to_fit();
+		cellSamples.clear();
+		cellPortals.clear();
+		cellChunks.clear();
+		portalCells.clear();
+		portalSamples.clear();
+		portalChunks.clear();
+		valid = true;
+	}
+
+	bool load(const VoxelGrid* grid, const std::string& path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			return false;
+		}
+		uint32_t magic = 0;
+		uint64_t hash = 0;
+		int runs = 0;
+		read(file, magic);
+		read(file, hash);
+		read(file, numCells);
+		read(file, numPortals);
+		read(file, runs);
+		if (!file || magic != PVS_MAGIC || hash != hashGrid(grid)) {
+			return false;
+		}
+		size = grid->size;
+		chunksPerSide = grid->chunksPerSide;
+		chunkWords = ((int)grid->chunks.size() + 63) / 64;
+
+		// labels are run-length encoded, long runs of rock compress well
+		labels.clear();
+		labels.reserve(size * size * size);
+		for (int i = 0; i < runs && file; i++) {
+			unsigned short label = NO_CELL;
+			uint32_t count = 0;
+			read(file, label);
+			read(file, count);
+			labels.insert(labels.end(), count, label);
+		}
+		chunkBits.resize(numCells * chunkWords);
+		file.read((char*)chunkBits.data(), chunkBits.size() * sizeof(uint64_t));
+		valid = file && (int)labels.size() == size * size * size;
+		return valid;
+	}
+
+	void save(const VoxelGrid* grid, const std::string& path) const {
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			std::cerr << "Failed to write " << path << std::endl;
+			return;
+		}
+		std::vector<std::pair<unsigned short, uint32_t>> runs;
+		for (auto label : labels) {
+			if (!runs.empty() && runs.back().first == label) {
+				runs.back().second++;
+			}
+			else {
+				runs.push_back({ label, 1 });
+			}
+		}
+		write(file, PVS_MAGIC);
+		write(file, hashGrid(grid));
+		write(file, numCells);
+		write(file, numPortals);
+		write(file, (int)runs.size());
+		for (auto& run : runs) {
+			write(file, run.first);
+			write(file, run.second);
+		}
+		file.write((const char*)chunkBits.data(), chunkBits.size() * sizeof(uint64_t));
+	}
+
+	void invalidate() {
+		valid = false;
+	}
+
+	int cellAt(const VoxelGrid* grid, glm::vec3 pos) const {
+		// -1 in rock or outside the grid
+		glm::ivec3 v = grid->worldToVoxel(pos);
+		if (!valid || !grid->inBounds(v.x, v.y, v.z)) {
+			return -1;
+		}
+		unsigned short label = labels[index(v.x, v.y, v.z)];
+		return (label == NO_CELL) ? -1 : (int)label;
+	}
+
+	bool chunkVisible(int cell, const Chunk* chunk) const {
+		int i = (chunk->coord.x * chunksPerSide + chunk->coord.y) * chunksPerSide + chunk->coord.z;
+		return (chunkBits[cell * chunkWords + i / 64] >> (i % 64)) & 1;
+	}
+
+	void filter(int cell, std::vector<Chunk*>& visible) const {
+		// drops chunks outside the cell's set, in place; no-op without a cell
+		if (!valid || cell < 0) {
+			return;
+		}
+		int kept = 0;
+		for (auto chunk : visible) {
+			if (chunkVisible(cell, chunk)) {
+				visible[kept++] = chunk;
+			}
+		}
+		visible.resize(kept);
+	}
+
+	float averageChunks() const {
+		if (numCells == 0) {
+			return 0.0f;
+		}
+		long long total = 0;
+		for (auto bits : chunkBits) {
+			total += popcount64(bits);
+		}
+		return (float)total / numCells;
+	}
+
+private:
+	int size;
+	int chunksPerSide;
+	int chunkWords;
+	// cell per voxel, NO_CELL for rock
+	std::vector<unsigned short> labels;
+	// chunkWords words per cell, bit i for grid->chunks[i]
+	std::vector<uint64_t> chunkBits;
+
+	// build only
+	// 0 for rock, otherwise steps to the nearest rock
+	std::vector<unsigned char> dist;
+	std::vector<glm::ivec3> cellSeed;
+	std::vector<int> cellPeak;
+	std::vector<std::vector<glm::vec3>> cellSamples;
+	std::vector<std::vector<int>> cellPortals;
+	std::vector<std::vector<uint64_t>> cellChunks;
+	std::vector<glm::ivec2> portalCells;
+	std::vector<std::vector<glm::vec3>> portalSamples;
+	std::vector<std::vector<uint64_t>> portalChunks;
+
+	int index(int x, int y, int z) const {
+		return (x * size + y) * size + z;
+	}
+
+	glm::ivec3 voxelOf(int i) const {
+		return glm::ivec3(i / (size * size), (i / size) % size, i % size);
+	}
+
+	bool air(glm::ivec3 v) const {
+		return v.x >= 0 && v.y >= 0 && v.z >= 0 && v.x < size && v.y < size && v.z < size && dist[index(v.x, v.y, v.z)] != 0;
+	}
+
+	static const glm::ivec3& neighbour(int n) {
+		static const glm::ivec3 offsets[6] = {
+			glm::ivec3(1, 0, 0), glm::ivec3(-1, 0, 0),
+			glm::ivec3(0, 1, 0), glm::ivec3(0, -1, 0),
+			glm::ivec3(0, 0, 1), glm::ivec3(0, 0, -1)
+		};
+		return offsets[n];
+	}
+
+	static int popcount64(uint64_t v) {
+		int count = 0;
+		while (v) {
+			v &= v - 1;
+			count++;
+		}
+		return count;
+	}
+
+	void computeDistances(const VoxelGrid* grid) {
+		// breadth first from the air touching rock or the border
+		const unsigned char UNSET = 255;
+		int n = size * size * size;
+		dist.assign(n, 0);
+		for (int i = 0; i < n; i++) {
+			glm::ivec3 v = voxelOf(i);
+			if (grid->getVoxel(v.x, v.y, v.z) == AIR) {
+				dist[i] = UNSET;
+			}
+		}
+		std::vector<int> queue;
+		for (int i = 0; i < n; i++) {
+			if (dist[i] != UNSET) {
+				continue;
+			}
+			glm::ivec3 v = voxelOf(i);
+			for (int k = 0; k < 6; k++) {
+				glm::ivec3 w = v + neighbour(k);
+				if (!grid->inBounds(w.x, w.y, w.z) || dist[index(w.x, w.y, w.z)] == 0) {
+					dist[i] = 1;
+					queue.push_back(i);
+					break;
+				}
+			}
+		}
+		for (size_t head = 0; head < queue.size(); head++) {
+			int i = queue[head];
+			glm::ivec3 v = voxelOf(i);
+			for (int k = 0; k < 6; k++) {
+				glm::ivec3 w = v + neighbour(k);
+				if (!grid->inBounds(w.x, w.y, w.z)) {
+					continue;
+				}
+				int j = index(w.x, w.y, w.z);
+				if (dist[j] == UNSET) {
+					dist[j] = (unsigned char)std::min(dist[i] + 1, UNSET - 1);
+					queue.push_back(j);
+				}
+			}
+		}
+	}
+
+	int pickCell(glm::ivec3 v) {
+		// the deepest labelled neighbour whose seed is close enough, or a new cell
+		int best = -1;
+		int bestDist = -1;
+		for (int k = 0; k < 6; k++) {
+			glm::ivec3 w = v + neighbour(k);
+			if (!air(w)) {
+				continue;
+			}
+			int j = index(w.x, w.y, w.z);
+			if (labels[j] == NO_CELL || dist[j] <= bestDist) {
+				continue;
+			}
+			glm::ivec3 reach = glm::abs(v - cellSeed[labels[j]]);
+			if (reach.x <= PVS_CELL_EXTENT && reach.y <= PVS_CELL_EXTENT && reach.z <= PVS_CELL_EXTENT) {
+				best = labels[j];
+				bestDist = dist[j];
+			}
+		}
+		if (best < 0) {
+			if ((int)cellSeed.size() >= NO_CELL) {
+				std::cerr << "Too many PVS cells" << std::endl;
+				exit(-1);
+			}
+			best = (int)cellSeed.size();
+			cellSeed.push_back(v);
+			cellPeak.push_back(dist[index(v.x, v.y, v.z)]);
+		}
+		return best;
+	}
+
+	void watershed() {
+		/*
+			Levels are flooded deepest first. Within a level, existing cells
+			grow first (breadth first, so plateaus split evenly between the
+			cells reaching them); whatever is left seeds new cells.
+		*/
+		int n = size * size * size;
+		labels.assign(n, NO_CELL);
+		cellSeed.clear();
+		cellPeak.clear();
+		std::vector<std::vector<int>> levels(256);
+		for (int i = 0; i < n; i++) {
+			if (dist[i] != 0) {
+				levels[dist[i]].push_back(i);
+			}
+		}
+
+		std::vector<int> frontier;
+		auto flood = [&](int d) {
+			for (size_t head = 0; head < frontier.size(); head++) {
+				int i = frontier[head];
+				if (labels[i] != NO_CELL) {
+					continue;
+				}
+				glm::ivec3 v = voxelOf(i);
+				labels[i] = (unsigned short)pickCell(v);
+				for (int k = 0; k < 6; k++) {
+					glm::ivec3 w = v + neighbour(k);
+					if (air(w) && dist[index(w.x, w.y, w.z)] == d && labels[index(w.x, w.y, w.z)] == NO_CELL) {
+						frontier.push_back(index(w.x, w.y, w.z));
+					}
+				}
+			}
+			frontier.clear();
+		};
+
+		for (int d = 255; d > 0; d--) {
+			for (int i : levels[d]) {
+				glm::ivec3 v = voxelOf(i);
+				for (int k = 0; k < 6; k++) {
+					glm::ivec3 w = v + neighbour(k);
+					if (air(w) && labels[index(w.x, w.y, w.z)] != NO_CELL) {
+						frontier.push_back(i);
+						break;
+					}
+				}
+			}
+			flood(d);
+			for (int i : levels[d]) {
+				if (labels[i] == NO_CELL) {
+					frontier.push_back(i);
+					flood(d);
+				}
+			}
+		}
+	}
+
+	template <typename F>
+	void forEachFace(F fn) {
+		// fn(i, j) for every pair of air voxels sharing a face with different cells
+		for (int x = 0; x < size; x++) {
+			for (int y = 0; y < size; y++) {
+				for (int z = 0; z < size; z++) {
+					int i = index(x, y, z);
+					if (dist[i] == 0) {
+						continue;
+					}
+					glm::ivec3 v(x, y, z);
+					for (int k = 0; k < 6; k += 2) {
+						glm::ivec3 w = v + neighbour(k);
+						if (air(w) && labels[index(w.x, w.y, w.z)] != labels[i]) {
+							fn(i, index(w.x, w.y, w.z));
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void mergeCells() {
+		/*
+			The deepest saddle between two cells is the widest point of the
+			passage joining them. When it is about as deep as the shallower
+			cell's peak there is no constriction between them, just a bumpy
+			distance field, and they merge as long as the result still fits
+			in one cell's extent.
+		*/
+		int cells = (int)cellSeed.size();
+		std::vector<glm::ivec3> lo(cells, glm::ivec3(size)), hi(cells, glm::ivec3(-1));
+		for (int i = 0; i < (int)labels.size(); i++) {
+			if (labels[i] != NO_CELL) {
+				lo[labels[i]] = glm::min(lo[labels[i]], voxelOf(i));
+				hi[labels[i]] = glm::max(hi[labels[i]], voxelOf(i));
+			}
+		}
+		std::map<std::pair<int, int>, int> saddles;
+		forEachFace([&](int i, int j) {
+			std::pair<int, int> key(std::min(labels[i], labels[j]), std::max(labels[i], labels[j]));
+			int& saddle = saddles[key];
+			saddle = std::max(saddle, (int)std::min(dist[i], dist[j]));
+		});
+		std::vector<std::pair<int, std::pair<int, int>>> order;
+		for (auto& s : saddles) {
+			order.push_back({ s.second, s.first });
+		}
+		std::sort(order.begin(), order.end(), [](const std::pair<int, std::pair<int, int>>& a, const std::pair<int, std::pair<int, int>>& b) {
+			return a.first > b.first;
+		});
+
+		std::vector<int> parent(cells);
+		for (int c = 0; c < cells; c++) {
+			parent[c] = c;
+		}
+		auto root = [&parent](int c) {
+			while (parent[c] != c) {
+				parent[c] = parent[parent[c]];
+				c = parent[c];
+			}
+			return c;
+		};
+		for (auto& o : order) {
+			int a = root(o.second.first);
+			int b = root(o.second.second);
+			if (a == b || std::min(cellPeak[a], cellPeak[b]) - o.first > PVS_MERGE_DEPTH) {
+				continue;
+			}
+			glm::ivec3 span = glm::max(hi[a], hi[b]) - glm::min(lo[a], lo[b]);
+			if (span.x > 2 * PVS_CELL_EXTENT || span.y > 2 * PVS_CELL_EXTENT || span.z > 2 * PVS_CELL_EXTENT) {
+				continue;
+			}
+			parent[b] = a;
+			lo[a] = glm::min(lo[a], lo[b]);
+			hi[a] = glm::max(hi[a], hi[b]);
+			cellPeak[a] = std::max(cellPeak[a], cellPeak[b]);
+		}
+
+		std::vector<int> compact(cells, -1);
+		numCells = 0;
+		for (int c = 0; c < cells; c++) {
+			if (root(c) == c) {
+				compact[c] = numCells++;
+			}
+		}
+		for (auto& label : labels) {
+			if (label != NO_CELL) {
+				label = (unsigned short)compact[root(label)];
+			}
+		}
+		cellSeed.clear();
+		cellPeak.clear();
+	}
+
+	static std::vector<glm::vec3> spread(const std::vector<glm::vec3>& points, int count) {
+		// farthest point sampling, starting next to the centroid
+		std::vector<glm::vec3> out;
+		if (points.empty()) {
+			return out;
+		}
+		glm::vec3 centre(0.0f);
+		for (auto& p : points) {
+			centre += p;
+		}
+		centre /= (float)points.size();
+		std::vector<float> nearest(points.size(), 1e30f);
+		int next = 0;
+		for (int i = 1; i < (int)points.size(); i++) {
+			glm::vec3 a = points[i] - centre;
+			glm::vec3 b = points[next] - centre;
+			if (glm::dot(a, a) < glm::dot(b, b)) {
+				next = i;
+			}
+		}
+		while ((int)out.size() < count) {
+			glm::vec3 chosen = points[next];
+			out.push_back(chosen);
+			for (int i = 0; i < (int)points.size(); i++) {
+				glm::vec3 d = points[i] - chosen;
+				nearest[i] = std::min(nearest[i], glm::dot(d, d));
+				if (nearest[i] > nearest[next]) {
+					next = i;
+				}
+			}
+			if (nearest[next] == 0.0f) {
+				break;
+			}
+		}
+		return out;
+	}
+
+	void findPortals() {
+		std::vector<std::vector<glm::vec3>> voxels(numCells);
+		cellChunks.assign(numCells, std::vector<uint64_t>(chunkWords, 0));
+		for (int i = 0; i < (int)labels.size(); i++) {
+			if (labels[i] == NO_CELL) {
+				continue;
+			}
+			glm::ivec3 v = voxelOf(i);
+			voxels[labels[i]].push_back(glm::vec3(v) + 0.5f);
+			// the cell sees the rock around it, which may sit in the next chunk; that
+			// includes rock touching only an edge or corner, seen past the rim of a face
+			for (int k = 0; k < 27; k++) {
+				glm::ivec3 w = v + glm::ivec3(k / 9 - 1, (k / 3) % 3 - 1, k % 3 - 1);
+				if (w.x < 0 || w.y < 0 || w.z < 0 || w.x >= size || w.y >= size || w.z >= size || air(w)) {
+					continue;
+				}
+				glm::ivec3 c = w / CHUNK_SIZE;
+				int chunk = (c.x * chunksPerSide + c.y) * chunksPerSide + c.z;
+				cellChunks[labels[i]][chunk / 64] |= 1ull << (chunk % 64);
+			}
+		}
+		cellSamples.resize(numCells);
+		for (int c = 0; c < numCells; c++) {
+			cellSamples[c] = spread(voxels[c], PVS_CELL_SAMPLES);
+		}
+
+		std::map<std::pair<int, int>, int> ids;
+		std::vector<std::vector<glm::vec3>> faces;
+		portalCells.clear();
+		portalChunks.clear();
+		forEachFace([&](int i, int j) {
+			std::pair<int, int> key(std::min(labels[i], labels[j]), std::max(labels[i], labels[j]));
+			auto it = ids.find(key);
+			if (it == ids.end()) {
+				it = ids.insert({ key, (int)portalCells.size() }).first;
+				portalCells.push_back(glm::ivec2(key.first, key.second));
+				faces.push_back(std::vector<glm::vec3>());
+				portalChunks.push_back(std::vector<uint64_t>(chunkWords, 0));
+			}
+			faces[it->second].push_back((glm::vec3(voxelOf(i)) + glm::vec3(voxelOf(j))) * 0.5f + 0.5f);
+			for (int v : { i, j }) {
+				glm::ivec3 c = voxelOf(v) / CHUNK_SIZE;
+				int chunk = (c.x * chunksPerSide + c.y) * chunksPerSide + c.z;
+				portalChunks[it->second][chunk / 64] |= 1ull << (chunk % 64);
+			}
+		});
+		numPortals = (int)portalCells.size();
+		cellPortals.assign(numCells, std::vector<int>());
+		portalSamples.resize(numPortals);
+		for (int p = 0; p < numPortals; p++) {
+			cellPortals[portalCells[p].x].push_back(p);
+			cellPortals[portalCells[p].y].push_back(p);
+			portalSamples[p] = spread(faces[p], PVS_PORTAL_SAMPLES);
+		}
+	}
+
+	bool lineOfSight(glm::vec3 from, glm::vec3 to) const {
+		// voxel DDA along the segment, false at the first rock voxel
+		glm::vec3 d = to - from;
+		glm::ivec3 v = glm::ivec3(glm::floor(from));
+		glm::ivec3 step;
+		glm::vec3 tMax, tDelta;
+		for (int a = 0; a < 3; a++) {
+			if (d[a] > 0.0f) {
+				step[a] = 1;
+				tDelta[a] = 1.0f / d[a];
+				tMax[a] = (v[a] + 1 - from[a]) * tDelta[a];
+			}
+			else if (d[a] < 0.0f) {
+				step[a] = -1;
+				tDelta[a] = -1.0f / d[a];
+				tMax[a] = (from[a] - v[a]) * tDelta[a];
+			}
+			else {
+				step[a] = 0;
+				tDelta[a] = 1e30f;
+				tMax[a] = 1e30f;
+			}
+		}
+		while (true) {
+			if (!air(v)) {
+				return false;
+			}
+			int a = (tMax.x < tMax.y) ? ((tMax.x < tMax.z) ? 0 : 2) : ((tMax.y < tMax.z) ? 1 : 2);
+			if (tMax[a] >= 1.0f - 1e-4f) {
+				return true;
+			}
+			v[a] += step[a];
+			tMax[a] += tDelta[a];
+		}
+	}
+
+	bool sees(int cell, int portal) const {
+		for (auto& from : cellSamples[cell]) {
+			for (auto& to : portalSamples[portal]) {
+				if (lineOfSight(from, to)) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	void solveCell(int c, std::vector<char>& reached, std::vector<int>& open) {
+		// breadth first through the portals the cell can see through
+		std::fill(reached.begin(), reached.end(), 0);
+		open.clear();
+		reached[c] = 1;
+		open.push_back(c);
+		uint64_t* bits = &chunkBits[c * chunkWords];
+		for (size_t head = 0; head < open.size(); head++) {
+			int x = open[head];
+			for (int w = 0; w < chunkWords; w++) {
+				bits[w] |= cellChunks[x][w];
+			}
+			for (int p : cellPortals[x]) {
+				int y = (portalCells[p].x == x) ? portalCells[p].y : portalCells[p].x;
+				// the cell's own portals are always open
+				if (!reached[y] && (x == c || sees(c, p))) {
+					reached[y] = 1;
+					open.push_back(y);
+				}
+			}
+		}
+	}
+
+	void solve(JobSystem* jobs) {
+		chunkBits.assign(numCells * chunkWords, 0);
+		if (jobs == NULL) {
+			std::vector<char> reached(numCells);
+			std::vector<int> open;
+			for (int c = 0; c < numCells; c++) {
+				solveCell(c, reached, open);
+			}
+		}
+		else {
+			jobs->parallelFor(0, numCells, 8, [this](int from, int to) {
+				std::vector<char> reached(numCells);
+				std::vector<int> open;
+				for (int c = from; c < to; c++) {
+					solveCell(c, reached, open);
+				}
+			});
+		}
+		dilate();
+	}
+
+	void dilate() {
+		// from the sampled sets, so a set only grows by one cell's worth
+		std::vector<uint64_t> sampled = chunkBits;
+		for (int c = 0; c < numCells; c++) {
+			uint64_t* bits = &chunkBits[c * chunkWords];
+			for (int p : cellPortals[c]) {
+				int y = (portalCells[p].x == c) ? portalCells[p].y : portalCells[p].x;
+				const uint64_t* across = &sampled[y * chunkWords];
+				for (int w = 0; w < chunkWords; w++) {
+					bits[w] |= across[w] | portalChunks[p][w];
+				}
+			}
+		}
+	}
+
+	static uint64_t hashGrid(const VoxelGrid* grid) {
+		// FNV-1a over the occupancy and the settings the sets depend on
+		uint64_t h = 14695981039346656037ull;
+		auto mix = [&h](const void* data, size_t bytes) {
+			const unsigned char* p = (const unsigned char*)data;
+			for (size_t i = 0; i < bytes; i++) {
+				h = (h ^ p[i]) * 1099511628211ull;
+			}
+		};
+		int settings[5] = { grid->size, PVS_CELL_EXTENT, PVS_MERGE_DEPTH, PVS_CELL_SAMPLES, PVS_PORTAL_SAMPLES };
+		mix(settings, sizeof(settings));
+		for (auto chunk : grid->chunks) {
+			mix(chunk->solid, sizeof(chunk->solid));
+		}
+		return h;
+	}
+
+	template <typename T>
+	static void read(std::istream& in, T& value) {
+		in.read((char*)&value, sizeof(T));
+	}
+
+	template <typename T>
+	static void write(std::ostream& out, const T& value) {
+		out.write((const char*)&value, sizeof(T));
+	}
+};
+
+class PVSRebuilder {
+public:
+	/*
+		Keeps a CavePVS in step with a grid that is being dug into. An edit
+		turns the current sets off, since they may hide a chunk seen through
+		the new hole. update() then builds fresh sets on the job system from
+		a snapshot of the voxels, and swaps them in once they land. An edit
+		made while a build runs makes that build stale: it is thrown away and
+		the next one starts from the new voxels. Everything here runs on the
+		simulation thread, which is also the only one reading the PVS.
+	*/
+	// builds swapped in since startup
+	int rebuilds;
+
+	PVSRebuilder() {
+		rebuilds = 0;
+		edits = 0;
+		startedAt = 0;
+		jobs = NULL;
+		job = NULL;
+		snapshot = NULL;
+		next = NULL;
+	}
+
+	~PVSRebuilder() {
+		finish();
+	}
+
+	PVSRebuilder(const PVSRebuilder&) = delete;
+	PVSRebuilder& operator=(const PVSRebuilder&) = delete;
+
+	void edited(CavePVS& pvs) {
+		pvs.invalidate();
+		edits++;
+	}
+
+	void update(CavePVS& pvs, const VoxelGrid* grid, JobSystem* j) {
+		// once per frame, after the edits have been applied to grid
+		if (job != NULL) {
+			if (!job->done) {
+				if (jobs->numWorkers() == 1) {
+					// no worker threads, so the simulation thread runs the build itself
+					jobs->runOne();
+				}
+				return;
+			}
+			bool current = (startedAt == edits);
+			if (current) {
+				pvs = std::move(*next);
+				rebuilds++;
+			}
+			finish();
+			if (current) {
+				return;
+			}
+		}
+		if (pvs.valid) {
+			return;
+		}
+		TRACE_ZONE("PVS rebuild start");
+		jobs = j;
+		startedAt = edits;
+		snapshot = grid->snapshot();
+		next = new CavePVS();
+		CavePVS* out = next;
+		const VoxelGrid* voxels = snapshot;
+		JobSystem* js = jobs;
+		job = jobs->run([out, voxels, js]() {
+			out->build(voxels, js);
+		});
+	}
+
+	bool building() const {
+		return job != NULL;
+	}
+
+	void finish() {
+		// waits for a build still running and drops it; before the job system goes away
+		if (job != NULL) {
+			jobs->finish(job);
+			job = NULL;
+		}
+		delete(snapshot);
+		snapshot = NULL;
+		delete(next);
+		next = NULL;
+	}
+
+private:
+	// edits since startup, and how many the running build has seen
+	long long edits;
+	long long startedAt;
+	JobSystem* jobs;
+	Job* job;
+	VoxelGrid* snapshot;
+	CavePVS* next;
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "chunk.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RAYCAST_SSE
+#endif
+
+// rays traced together by castPacket()
+const int RAY_PACKET = 8;
+
+class RayHit {
+public:
+	bool hit;
+	// grid voxel coordinates
+	glm::ivec3 voxel;
+	// faceDir of the hit voxel the ray came in through, -1 if it started inside rock
+	int face;
+	// along the ray, in multiples of its direction
+	float distance;
+	unsigned char material;
+
+	RayHit() {
+		hit = false;
+		voxel = glm::ivec3(-1);
+		face = -1;
+		distance = 0.0f;
+		material = AIR;
+	}
+};
+
+class Raycaster {
+public:
+	/*
+		Amanatides-Woo DDA over the voxel grid
+		---------------------
+		The ray steps from cell to cell, where a cell is the largest empty
+		block around the current voxel: a whole empty chunk, an empty 8^3
+		brick (Chunk::usedBricks), or a single voxel. Only bricks with
+		something in them are walked voxel by voxel.
+		---------------------
+		Origins and directions are in world space. Distances are in
+		multiples of dir, so a normalized dir gives world units.
+	*/
+	Raycaster(const VoxelGrid* g) {
+		grid = g;
+	}
+
+	RayHit cast(glm::vec3 origin, glm::vec3 dir, float maxDist) const {
+		RayHit result;
+		Ray ray;
+		if (!enter(origin, dir, maxDist, ray)) {
+			return result;
+		}
+		while (true) {
+			glm::ivec3 lo;
+			int cellSize;
+			unsigned char m = cellAt(ray.voxel, lo, cellSize);
+			if (m != AIR) {
+				result.hit = true;
+				result.voxel = ray.voxel;
+				result.face = ray.face;
+				result.distance = ray.t;
+				result.material = m;
+				return result;
+			}
+
+			// leave through the nearest of the cell's far planes
+			float tExit[3];
+			for (int a = 0; a < 3; a++) {
+				float bound = (float)lo[a] + (ray.stepPos[a] ? cellSize : 0);
+				tExit[a] = (bound - ray.o[a]) * ray.inv[a];
+			}
+			// ties go to the lowest axis, same as castPacket()
+			int a = (tExit[0] <= tExit[1] && tExit[0] <= tExit[2]) ? 0 : ((tExit[1] <= tExit[2]) ? 1 : 2);
+			ray.t = tExit[a];
+			if (ray.t > ray.tLeave) {
+				return result;
+			}
+			glm::vec3 p = ray.o + ray.d * ray.t;
+			glm::ivec3 next;
+			for (int b = 0; b < 3; b++) {
+				next[b] = glm::clamp((int)std::floor(p[b]), lo[b], lo[b] + cellSize - 1);
+			}
+			next[a] = ray.stepPos[a] ? lo[a] + cellSize : lo[a] - 1;
+			if (!grid->inBounds(next.x, next.y, next.z)) {
+				return result;
+			}
+			ray.voxel = next;
+			ray.face = 2 * a + (ray.stepPos[a] ? 1 : 0);
+		}
+	}
+
+	bool lineOfSight(glm::vec3 from, glm::vec3 to) const {
+		// true when no rock lies on the segment
+		return !cast(from, to - from, 1.0f).hit;
+	}
+
+	void castPacket(const glm::vec3 origins[RAY_PACKET], const glm::vec3 dirs[RAY_PACKET], float maxDist, RayHit hits[RAY_PACKET]) const {
+		/*
+			Eight rays in lockstep. Looking up each ray's cell is a gather
+			and stays scalar; the exit planes, the nearest one and the next
+			voxel are worked out for all eight at once, four per SSE
+			register. Rays drop out of the packet as they hit or leave.
+			Coherent rays (neighbouring pixels) cross cells of the same size
+			at about the same time, so few lanes idle.
+		*/
+#ifdef RAYCAST_SSE
+		alignas(16) float o[3][RAY_PACKET], d[3][RAY_PACKET], inv[3][RAY_PACKET], stepPos[3][RAY_PACKET];
+		alignas(16) float lo[3][RAY_PACKET], cellSize[RAY_PACKET], t[RAY_PACKET];
+		alignas(16) int next[3][RAY_PACKET];
+		int exitAxis[RAY_PACKET];
+		Ray rays[RAY_PACKET];
+		int active = 0;
+		for (int i = 0; i < RAY_PACKET; i++) {
+			hits[i] = RayHit();
+			if (enter(origins[i], dirs[i], maxDist, rays[i])) {
+				active |= 1 << i;
+			}
+			for (int a = 0; a < 3; a++) {
+				o[a][i] = rays[i].o[a];
+				d[a][i] = rays[i].d[a];
+				inv[a][i] = rays[i].inv[a];
+				stepPos[a][i] = rays[i].stepPos[a] ? 1.0f : 0.0f;
+				lo[a][i] = 0.0f;
+			}
+			cellSize[i] = 1.0f;
+		}
+
+		while (active) {
+			for (int i = 0; i < RAY_PACKET; i++) {
+				if (!(active & (1 << i))) {
+					continue;
+				}
+				glm::ivec3 cellLo;
+				int size;
+				unsigned char m = cellAt(rays[i].voxel, cellLo, size);
+				if (m != AIR) {
+					hits[i].hit = true;
+					hits[i].voxel = rays[i].voxel;
+					hits[i].face = rays[i].face;
+					hits[i].distance = rays[i].t;
+					hits[i].material = m;
+					active &= ~(1 << i);
+					continue;
+				}
+				for (int a = 0; a < 3; a++) {
+					lo[a][i] = (float)cellLo[a];
+				}
+				cellSize[i] = (float)size;
+			}
+			if (!active) {
+				break;
+			}
+
+			for (int half = 0; half < RAY_PACKET; half += 4) {
+				__m128 size = _mm_load_ps(&cellSize[half]);
+				__m128 tAxis[3];
+				for (int a = 0; a < 3; a++) {
+					__m128 bound = _mm_add_ps(_mm_load_ps(&lo[a][half]), _mm_mul_ps(size, _mm_load_ps(&stepPos[a][half])));
+					tAxis[a] = _mm_mul_ps(_mm_sub_ps(bound, _mm_load_ps(&o[a][half])), _mm_load_ps(&inv[a][half]));
+				}
+				__m128 tMin = _mm_min_ps(tAxis[0], _mm_min_ps(tAxis[1], tAxis[2]));
+				__m128 isX = _mm_cmpeq_ps(tAxis[0], tMin);
+				__m128 isY = _mm_andnot_ps(isX, _mm_cmpeq_ps(tAxis[1], tMin));
+				__m128 isAxis[3] = { isX, isY, _mm_andnot_ps(_mm_or_ps(isX, isY), _mm_castsi128_ps(_mm_set1_epi32(-1))) };
+				_mm_store_ps(&t[half], tMin);
+
+				for (int a = 0; a < 3; a++) {
+					__m128 cellLo = _mm_load_ps(&lo[a][half]);
+					__m128 cellHi = _mm_sub_ps(_mm_add_ps(cellLo, size), _mm_set1_ps(1.0f));
+					__m128 p = _mm_add_ps(_mm_load_ps(&o[a][half]), _mm_mul_ps(_mm_load_ps(&d[a][half]), tMin));
+					// clamped into the cell, which starts at >= 0, so truncation is floor
+					__m128 inside = _mm_min_ps(_mm_max_ps(p, cellLo), cellHi);
+					// stepping out: lo + size going up, lo - 1 going down
+					__m128 beyond = _mm_add_ps(_mm_sub_ps(cellLo, _mm_set1_ps(1.0f)),
+						_mm_mul_ps(_mm_add_ps(size, _mm_set1_ps(1.0f)), _mm_load_ps(&stepPos[a][half])));
+					__m128 v = _mm_or_ps(_mm_and_ps(isAxis[a], beyond), _mm_andnot_ps(isAxis[a], inside));
+					_mm_store_si128((__m128i*)&next[a][half], _mm_cvttps_epi32(v));
+				}
+				int maskX = _mm_movemask_ps(isX);
+				int maskY = _mm_movemask_ps(isY);
+				for (int lane = 0; lane < 4; lane++) {
+					exitAxis[half + lane] = (maskX & (1 << lane)) ? 0 : ((maskY & (1 << lane)) ? 1 : 2);
+				}
+			}
+
+			for (int i = 0; i < RAY_PACKET; i++) {
+				if (!(active & (1 << i))) {
+					continue;
+				}
+				glm::ivec3 v(next[0][i], next[1][i], next[2][i]);
+				if (t[i] > rays[i].tLeave || !grid->inBounds(v.x, v.y, v.z)) {
+					active &= ~(1 << i);
+					continue;
+				}
+				rays[i].t = t[i];
+				rays[i].voxel = v;
+				rays[i].face = 2 * exitAxis[i] + (rays[i].stepPos[exitAxis[i]] ? 1 : 0);
+			}
+		}
+#else
+		for (int i = 0; i < RAY_PACKET; i++) {
+			hits[i] = cast(origins[i], dirs[i], maxDist);
+		}
+#endif
+	}
+
+private:
+	class Ray {
+	public:
+		// grid space, where voxel v covers [v, v + 1)
+		glm::vec3 o;
+		glm::vec3 d;
+		glm::vec3 inv;
+		glm::bvec3 stepPos;
+		float t;
+		float tLeave;
+		glm::ivec3 voxel;
+		int face;
+	};
+
+	const VoxelGrid* grid;
+
+	bool enter(glm::vec3 origin, glm::vec3 dir, float maxDist, Ray& ray) const {
+		/*
+			Clips the ray to the grid and finds its first voxel. Axes the
+			ray doesn't move along count as stepping up with a huge inverse,
+			so their exit distance is always far away instead of NaN.
+		*/
+		ray.o = origin - grid->origin;
+		ray.d = dir;
+		ray.t = 0.0f;
+		ray.tLeave = maxDist;
+		int enterAxis = -1;
+		for (int a = 0; a < 3; a++) {
+			ray.stepPos[a] = dir[a] >= 0.0f;
+			ray.inv[a] = (dir[a] != 0.0f) ? 1.0f / dir[a] : 1e30f;
+			float t0 = (0.0f - ray.o[a]) * ray.inv[a];
+			float t1 = ((float)grid->size - ray.o[a]) * ray.inv[a];
+			if (t0 > t1) {
+				std::swap(t0, t1);
+			}
+			if (t0 > ray.t) {
+				ray.t = t0;
+				enterAxis = a;
+			}
+			ray.tLeave = std::min(ray.tLeave, t1);
+		}
+		if (ray.t > ray.tLeave) {
+			return false;
+		}
+		glm::vec3 p = ray.o + ray.d * ray.t;
+		for (int a = 0; a < 3; a++) {
+			ray.voxel[a] = glm::clamp((int)std::floor(p[a]), 0, grid->size - 1);
+		}
+		ray.face = -1;
+		if (enterAxis >= 0) {
+			ray.voxel[enterAxis] = ray.stepPos[enterAxis] ? 0 : grid->size - 1;
+			ray.face = 2 * enterAxis + (ray.stepPos[enterAxis] ? 1 : 0);
+		}
+		return true;
+	}
+
+	unsigned char cellAt(glm::ivec3 v, glm::ivec3& lo, int& cellSize) const {
+		// the voxel's material, or AIR and the largest empty cell holding it
+		const Chunk* chunk = grid->chunkAt(v / CHUNK_SIZE);
+		glm::ivec3 l = v % CHUNK_SIZE;
+		unsigned char m = AIR;
+		if (chunk->empty()) {
+			cellSize = CHUNK_SIZE;
+		}
+		else if (!((chunk->usedBricks >> Chunk::brickIndex(l.x / BRICK_SIZE, l.y / BRICK_SIZE, l.z / BRICK_SIZE)) & 1)) {
+			cellSize = BRICK_SIZE;
+		}
+		else {
+			m = chunk->get(l.x, l.y, l.z);
+			cellSize = 1;
+		}
+		lo = (v / cellSize) * cellSize;
+		return m;
+	}
+};
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <vector>
+#include <glm/glm.hpp>
+#include "chunk.h"
+#include "memory.h"
+#include "mesher.h"
+
+typedef enum renderMode {
+	CUBE_MODE,
+	INSTANCED_MODE,
+	CHUNK_MODE
+} renderMode;
+
+class ChunkDraw {
+public:
+	// a key for the chunk's GPU mesh; the render thread never reads through it
+	const Chunk* chunk;
+	glm::vec3 origin;
+};
+
+class MeshOp {
+public:
+	const Chunk* chunk;
+	// false: vertices replace the chunk's mesh; true: the mesh is freed
+	bool release;
+	std::vector<packedVertex> vertices;
+};
+
+class RenderList {
+public:
+	/*
+		Everything the render thread needs for one frame, built by the
+		simulation thread: camera, per-frame settings, the chunks that
+		survived culling, and the mesh changes since the last list, in the
+		order they happened.
+	*/
+	long long frame;
+	float time;
+	int width;
+	int height;
+	renderMode mode;
+	bool overlay;
+	float mixVal;
+	glm::mat4 view;
+	glm::mat4 projection;
+	std::vector<ChunkDraw> draws;
+	std::vector<MeshOp> meshOps;
+	// simulation side of the frame, for the profiler
+	double inputMs;
+	double updateMs;
+	double cullingMs;
+	int frustumCulled;
+	int pvsCulled;
+	int occlusionCulled;
+
+	RenderList() {
+		frame = -1;
+		time = 0.0f;
+		width = 0;
+		height = 0;
+		mode = CHUNK_MODE;
+		overlay = false;
+		mixVal = 0.0f;
+		view = glm::mat4(1.0f);
+		projection = glm::mat4(1.0f);
+		clearStats();
+	}
+
+	void clearStats() {
+		inputMs = 0.0;
+		updateMs = 0.0;
+		cullingMs = 0.0;
+		frustumCulled = 0;
+		pvsCulled = 0;
+		occlusionCulled = 0;
+	}
+};
+
+class RenderQueue {
+public:
+	/*
+		Simulation -> render handoff
+		---------------------
+		simulation fills writing() -> publish() -> mailbox -> acquire() -> render thread draws it
+		---------------------
+		Each side owns one list. A third slot, the mailbox, sits between
+		them, and handing a list over is a swap with the mailbox under a
+		short lock. Neither thread ever waits for the other.
+		- If the simulation publishes twice before the render thread picks
+		  up, the older list's draws are dropped. Its mesh changes are
+		  carried into the newer list, in order, so no upload or release is
+		  ever lost.
+		- If the render thread finishes before a new list arrives, it draws
+		  its current list again. A slow simulation frame then repeats an
+		  image instead of dropping one.
+		With lockstep set (flythrough replays) both sides wait instead, so
+		every simulated frame is drawn exactly once.
+		---------------------
+		Lists are recycled, so once their vectors have grown, a frame
+		allocates nothing here.
+	*/
+	bool lockstep;
+
+	RenderQueue() {
+		lockstep = false;
+		write = 0;
+		ready = 1;
+		read = 2;
+		fresh = false;
+		running = true;
+		status[0] = '\0';
+		lists[0].draws.reserve(1024);
+		lists[1].draws.reserve(1024);
+		lists[2].draws.reserve(1024);
+	}
+
+	// simulation thread only
+	RenderList& writing() {
+		return lists[write];
+	}
+
+	void submitMesh(const Chunk* chunk, std::vector<packedVertex>& vertices) {
+		// takes the vertices; their MEM_MESHES bytes move with them
+		MeshOp& op = pushOp(chunk, false);
+		op.vertices.swap(vertices);
+	}
+
+	void releaseMesh(const Chunk* chunk) {
+		pushOp(chunk, true);
+	}
+
+	void publish() {
+		std::unique_lock<std::mutex> guard(lock);
+		if (lockstep) {
+			consumed.wait(guard, [this]() { return !fresh || !running; });
+		}
+		RenderList& next = lists[write];
+		RenderList& stale = lists[ready];
+		if (fresh && !stale.meshOps.empty()) {
+			// nobody drew the stale list, but its mesh changes still have to land first
+			stale.meshOps.insert(stale.meshOps.end(), std::make_move_iterator(next.meshOps.begin()), std::make_move_iterator(next.meshOps.end()));
+			next.meshOps.swap(stale.meshOps);
+		}
+		std::swap(write, ready);
+		fresh = true;
+		guard.unlock();
+		arrived.notify_one();
+
+		// the list we got back was either drawn or superseded
+		RenderList& recycled = lists[write];
+		recycled.draws.clear();
+		recycled.meshOps.clear();
+		recycled.clearStats();
+	}
+
+	// render thread only; returns whether the list is new since the last call
+	bool acquire(RenderList** list) {
+		std::unique_lock<std::mutex> guard(lock);
+		if (lockstep) {
+			arrived.wait(guard, [this]() { return fresh || !running; });
+		}
+		bool got = fresh;
+		if (fresh) {
+			std::swap(read, ready);
+			fresh = false;
+		}
+		guard.unlock();
+		consumed.notify_one();
+		*list = &lists[read];
+		return got;
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			running = false;
+		}
+		arrived.notify_all();
+		consumed.notify_all();
+	}
+
+	bool isRunning() {
+		std::lock_guard<std::mutex> guard(lock);
+		return running;
+	}
+
+	void discard() {
+		// at shutdown, once the render thread is gone: drop mesh changes nobody will upload
+		for (int i = 0; i < 3; i++) {
+			for (auto& op : lists[i].meshOps) {
+				MemoryTracker::get().release(MEM_MESHES, op.vertices.capacity() * sizeof(packedVertex));
+			}
+			lists[i].meshOps.clear();
+			lists[i].draws.clear();
+		}
+	}
+
+	// a line for the window title, set by the render thread and read by the main one
+	void setStatus(const char* text) {
+		std::lock_guard<std::mutex> guard(lock);
+		strncpy(status, text, sizeof(status) - 1);
+		status[sizeof(status) - 1] = '\0';
+	}
+
+	void getStatus(char* out, size_t size) {
+		std::lock_guard<std::mutex> guard(lock);
+		strncpy(out, status, size - 1);
+		out[size - 1] = '\0';
+	}
+
+private:
+	RenderList lists[3];
+	int write;
+	int ready;
+	int read;
+	// the mailbox holds a list the render thread hasn't taken yet
+	bool fresh;
+	bool running;
+	std::mutex lock;
+	std::condition_variable arrived;
+	std::condition_variable consumed;
+	char status[160];
+
+	MeshOp& pushOp(const Chunk* chunk, bool release) {
+		std::vector<MeshOp>& ops = lists[write].meshOps;
+		ops.emplace_back();
+		ops.back().chunk = chunk;
+		ops.back().release = release;
+		return ops.back();
+	}
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+	Render queue check
+	---------------------
+	g++ -O2 -std=c++17 -Iinclude src/render_queue_check.cpp -lpthread -o cave_render_queue_check
+	./cave_render_queue_check [--frames N]
+	A simulation thread publishes N render lists as fast as it can. Each
+	list carries 0-2 mesh changes and a draw tagged with its frame. A
+	render thread acquires lists the way renderLoop() does. This runs
+	once freely and once in lockstep, and checks that:
+	- every mesh change arrives exactly once, in submission order, even
+	  when the list it was submitted with was superseded;
+	- lists arrive in frame order, and no list mixes two frames' draws;
+	- in lockstep, every frame is drawn exactly once;
+	- writing() always hands the simulation an empty list.
+	Exits non-zero if any check fails.
+	---------------------
+*/
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "render_queue.h"
+#include "test_cave.h"
+
+class QueueCheck {
+public:
+    long long published;
+    long long submitted;
+    // render thread side
+    long long arrived;
+    long long fresh;
+    long long redrawn;
+    std::atomic<int> errors;
+
+    QueueCheck() {
+        published = 0;
+        submitted = 0;
+        arrived = 0;
+        fresh = 0;
+        redrawn = 0;
+        errors = 0;
+    }
+
+    void fail(const char* what) {
+        if (errors++ == 0) {
+            std::cerr << "ERROR::RENDER_QUEUE_CHECK::" << what << std::endl;
+        }
+    }
+};
+
+bool isRelease(long long op) {
+    // every third mesh change frees a mesh instead of replacing it
+    return op % 3 == 2;
+}
+
+void takeOps(RenderList* list, QueueCheck& check) {
+    // the changes must continue the sequence exactly
+    for (auto& op : list->meshOps) {
+        bool release = isRelease(check.arrived);
+        if (op.release != release || (!release && (op.vertices.size() != 1 || (long long)op.vertices[0] != check.arrived))) {
+            check.fail("MESH_OP_OUT_OF_ORDER");
+        }
+        check.arrived++;
+    }
+    // runRenderWork() empties the list the same way
+    list->meshOps.clear();
+}
+
+void renderSide(RenderQueue* queue, QueueCheck* check) {
+    long long lastFrame = -1;
+    while (queue->isRunning()) {
+        RenderList* list;
+        bool fresh = queue->acquire(&list);
+        if (!fresh && queue->lockstep) {
+            continue;
+        }
+        if (list->frame < 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (fresh) {
+            check->fresh++;
+            if (list->frame <= lastFrame || (queue->lockstep && list->frame != lastFrame + 1)) {
+                check->fail("FRAME_ORDER");
+            }
+            lastFrame = list->frame;
+        }
+        else {
+            check->redrawn++;
+        }
+        if (list->draws.size() != 1 || (long long)list->draws[0].origin.x != list->frame) {
+            check->fail("DRAWS_FROM_ANOTHER_FRAME");
+        }
+        takeOps(list, *check);
+    }
+    // whatever was published after the last acquire
+    RenderList* list;
+    if (queue->acquire(&list)) {
+        check->fresh++;
+        takeOps(list, *check);
+    }
+}
+
+bool run(bool lockstep, long long frames) {
+    RenderQueue queue;
+    queue.lockstep = lockstep;
+    QueueCheck check;
+    std::thread renderer(renderSide, &queue, &check);
+    for (long long frame = 0; frame < frames; frame++) {
+        RenderList& list = queue.writing();
+        if (!list.draws.empty() || !list.meshOps.empty()) {
+            check.fail("WRITING_NOT_EMPTY");
+        }
+        for (int i = 0; i < frame % 3; i++) {
+            if (isRelease(check.submitted)) {
+                queue.releaseMesh(NULL);
+            }
+            else {
+                std::vector<packedVertex> vertices(1, (packedVertex)check.submitted);
+                queue.submitMesh(NULL, vertices);
+            }
+            check.submitted++;
+        }
+        list.draws.push_back({ NULL, glm::vec3((float)frame, 0.0f, 0.0f) });
+        list.frame = frame;
+        queue.publish();
+        check.published++;
+    }
+    queue.stop();
+    renderer.join();
+
+    if (check.arrived != check.submitted) {
+        check.fail("MESH_OPS_LOST");
+    }
+    if (lockstep && check.fresh != frames) {
+        check.fail("LOCKSTEP_FRAMES_DROPPED");
+    }
+    std::cout << (lockstep ? "lockstep: " : "free:     ") << check.published << " lists published, " << check.fresh << " drawn fresh, "
+        << check.redrawn << " redrawn; " << check.arrived << "/" << check.submitted << " mesh changes arrived" << std::endl;
+    return check.errors == 0;
+}
+
+int main(int argc, char** argv) {
+    long long frames = intOption(argc, argv, "--frames", 200000);
+    MemoryTracker::get().quiet = true;
+    bool ok = run(false, frames);
+    ok = run(true, frames) && ok;
+    std::cout << (ok ? "Render queue checks passed" : "Render queue checks failed") << std::endl;
+    return ok ? 0 : -1;
+}
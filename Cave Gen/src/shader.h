@@ -2,7 +2,9 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -10,9 +12,24 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+class UniformHandle {
+public:
+	// FNV-1a of the uniform name, computed at compile time for literals
+	uint32_t hash;
+
+	constexpr UniformHandle(const char* name) : hash(hashName(name)) {}
+	UniformHandle(const std::string& name) : hash(hashName(name.c_str())) {}
+
+	static constexpr uint32_t hashName(const char* s, uint32_t h = 2166136261u) {
+		return (*s == 0) ? h : hashName(s + 1, (h ^ (uint8_t)*s) * 16777619u);
+	}
+};
+
 class Shader {
 public:
 	unsigned int progID;
+	// uniform locations by name hash, filled once after linking
+	std::unordered_map<uint32_t, int> locations;
 
 	Shader(const char* vertexPath, const char* fragmentPath) {
 		std::string vertexCode;
@@ -71,23 +88,105 @@ public:
 
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
+
+		reflectUniforms();
 	};
 
+	void reflectUniforms() {
+		int count = 0;
+		glGetProgramiv(progID, GL_ACTIVE_UNIFORMS, &count);
+		char name[256];
+		for (int i = 0; i < count; i++) {
+			int length, size;
+			GLenum type;
+			glGetActiveUniform(progID, i, sizeof(name), &length, &size, &type, name);
+			int loc = glGetUniformLocation(progID, name);
+			if (loc < 0) {
+				// members of uniform blocks have no location
+				continue;
+			}
+			// arrays are reported as "name[0]"
+			std::string base(name, length);
+			auto bracket = base.find('[');
+			if (bracket != std::string::npos) {
+				base = base.substr(0, bracket);
+			}
+			locations[UniformHandle::hashName(base.c_str())] = loc;
+		}
+	}
+
+	int location(UniformHandle handle) const {
+		auto it = locations.find(handle.hash);
+		return (it == locations.end()) ? -1 : it->second;
+	}
+
+	void bindBlock(const char* name, unsigned int binding) {
+		unsigned int index = glGetUniformBlockIndex(progID, name);
+		if (index != GL_INVALID_INDEX) {
+			glUniformBlockBinding(progID, index, binding);
+		}
+	}
+
 	void use() {
 		glUseProgram(progID);
 	};
-	void setBool(const std::string& name, bool value) const {
-		glUniform1i(glGetUniformLocation(progID, name.c_str()), (int)value);
+	void setBool(UniformHandle handle, bool value) const {
+		glUniform1i(location(handle), (int)value);
 	};
-	void setInt(const std::string& name, int value) const {
-		glUniform1i(glGetUniformLocation(progID, name.c_str()), value);
+	void setInt(UniformHandle handle, int value) const {
+		glUniform1i(location(handle), value);
 	};
-	void setFloat(const std::string& name, float value) const {
-		glUniform1f(glGetUniformLocation(progID, name.c_str()), value);
+	void setFloat(UniformHandle handle, float value) const {
+		glUniform1f(location(handle), value);
 	};
-	void setMat4(const std::string& name, glm::mat4 mat) const {
-		glUniformMatrix4fv(glGetUniformLocation(progID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+	void setVec3(UniformHandle handle, glm::vec3 vec) const {
+		glUniform3fv(location(handle), 1, glm::value_ptr(vec));
+	}
+	void setMat4(UniformHandle handle, const glm::mat4& mat) const {
+		glUniformMatrix4fv(location(handle), 1, GL_FALSE, glm::value_ptr(mat));
+	}
+};
+
+// binding point of the Frame uniform block shared by every program
+const unsigned int FRAME_BINDING = 0;
+
+class FrameUniforms {
+public:
+	/*
+		Per-frame data in one uniform buffer, std140 layout:
+		---------------------
+		layout (std140) uniform Frame {
+			mat4 view;
+			mat4 projection;
+			float time;
+		};
+		---------------------
+	*/
+	unsigned int UBO;
+
+	FrameUniforms() {
+		glGenBuffers(1, &UBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(data), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, UBO);
 	}
+
+	void update(const glm::mat4& view, const glm::mat4& projection, float time) {
+		data.view = view;
+		data.projection = projection;
+		data.time = glm::vec4(time, 0.0f, 0.0f, 0.0f);
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+private:
+	struct {
+		glm::mat4 view;
+		glm::mat4 projection;
+		glm::vec4 time;
+	} data;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,666 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "chunk.h"
+#include "frustum.h"
+#include "jobs.h"
+#include "memory.h"
+#include "mesher.h"
+#include "mpsc_queue.h"
+#include "prefetch.h"
+#include "tracer.h"
+
+// chunk generation and meshing jobs allowed in flight per worker
+const int STREAM_JOBS_PER_WORKER = 2;
+// meshes handed to the GPU per frame
+const int STREAM_UPLOADS_PER_FRAME = 8;
+// cave noise: feature size in voxels, and how wide the tunnels are
+const float STREAM_NOISE_SCALE = 48.0f;
+const float STREAM_TUNNEL_WIDTH = 0.06f;
+// seconds of predicted camera path that get loaded ahead of time
+const float STREAM_PREFETCH_SECONDS = 3.0f;
+
+typedef enum streamState {
+	STREAM_GENERATING,
+	STREAM_GENERATED,
+	STREAM_MESHING,
+	STREAM_MESHED,
+	STREAM_READY
+} streamState;
+
+class StreamChunk {
+public:
+	glm::ivec3 coord;
+	Chunk* chunk;
+	streamState state;
+	// mesh jobs reading this chunk as a neighbour; it can't be unloaded until 0
+	int pins;
+	// from the mesh job until the upload
+	std::vector<packedVertex> mesh;
+	float priority;
+	// generated for the predicted path, and whether it has been in view range since
+	bool prefetched;
+	bool used;
+};
+
+class StreamCandidate {
+public:
+	glm::ivec3 coord;
+	float priority;
+	// centres whose generation range covers it; it stops being a candidate at 0
+	int sources;
+	// NULL until generation starts
+	StreamChunk* sc;
+};
+
+class ChunkNeighbourhood {
+public:
+	// the 3^3 chunks around centre, for meshing one streamed chunk
+	glm::ivec3 centre;
+	const Chunk* chunks[27];
+
+	const Chunk* chunkAt(int cx, int cy, int cz) const {
+		int dx = cx - centre.x + 1;
+		int dy = cy - centre.y + 1;
+		int dz = cz - centre.z + 1;
+		if (dx < 0 || dy < 0 || dz < 0 || dx > 2 || dy > 2 || dz > 2) {
+			return NULL;
+		}
+		return chunks[(dx * 3 + dy) * 3 + dz];
+	}
+};
+
+class StreamingWorld {
+public:
+	/*
+		Streaming world
+		---------------------
+		generate (radius + 2) -> mesh (radius + 1) -> upload -> draw (radius) -> unload (radius + 3)
+		---------------------
+		The world has no edges. Chunks live in a hash map keyed by
+		coordinate and follow the camera.
+		Generation: a worker fills the chunk from a seeded noise field. The
+		field depends only on world voxel coordinates, so a chunk that is
+		unloaded and regenerated comes back identical.
+		Meshing: a chunk is meshed once its 26 neighbours exist, so borders
+		cull and shade correctly. Its neighbours are pinned until the job
+		finishes.
+		Jobs are started nearest-first, weighted towards the view direction.
+		At most uploadsPerFrame finished meshes go to uploadMesh per frame, in
+		the same order.
+		Only chunks within radius are drawn. Each stage reaches one chunk
+		further than the next: a chunk crossing into draw range was already
+		meshed a step earlier, and one that can be meshed already has its
+		neighbours generated. Chunks beyond radius + 3 are dropped; the gap
+		between load and unload radius keeps the border from thrashing.
+		---------------------
+		Prefetching: the camera's recent motion is extrapolated
+		prefetchSeconds ahead (see CameraTrajectory). The chunks that path
+		passes through count as centres too, so what the camera will see
+		when it gets there is generated and meshed early. A job's order is
+		its estimated arrival distance: how far along the path the camera
+		is when it is nearest, plus how far off the path it lies. Chunks the
+		camera is leaving behind go to the back. Each time the camera
+		enters a new chunk, every chunk coming into view range is a hit if
+		it is already drawable and a miss if not.
+		---------------------
+		Everything except the jobs runs on the main thread, which owns the
+		map. Jobs only see their own chunk and the neighbour pointers
+		handed to them.
+	*/
+	int radius;
+	uint32_t seed;
+	int uploadsPerFrame;
+	meshMode meshing;
+	// GL hooks, called on the main thread; left NULL without a GL context.
+	// uploadMesh may take the vertices, and sets the chunk's vertexCount
+	void (*uploadMesh)(Chunk* chunk, std::vector<packedVertex>& mesh);
+	void (*releaseMesh)(Chunk* chunk);
+	// since the last update()
+	int generated;
+	int meshed;
+	int uploaded;
+	int unloaded;
+	// 0 loads by distance alone
+	float prefetchSeconds;
+	PrefetchStats prefetch;
+
+	StreamingWorld(JobSystem* j, int r, uint32_t s) {
+		jobs = j;
+		radius = r;
+		seed = s;
+		uploadsPerFrame = STREAM_UPLOADS_PER_FRAME;
+		meshing = GREEDY;
+		uploadMesh = NULL;
+		releaseMesh = NULL;
+		generated = 0;
+		meshed = 0;
+		uploaded = 0;
+		unloaded = 0;
+		inFlight = 0;
+		prefetchSeconds = STREAM_PREFETCH_SECONDS;
+		path.count = 0;
+		path.speed = 0.0f;
+		centre = glm::ivec3(INT32_MIN);
+		gatheredCentre = centre;
+		settled = false;
+	}
+
+	~StreamingWorld() {
+		while (inFlight > 0) {
+			collect();
+			if (!jobs->runOne()) {
+				std::this_thread::yield();
+			}
+		}
+		collect();
+		for (auto& entry : chunks) {
+			drop(entry.second);
+		}
+	}
+
+	static glm::ivec3 chunkOf(glm::vec3 pos) {
+		return glm::ivec3(glm::floor(pos / (float)CHUNK_SIZE));
+	}
+
+	glm::vec3 chunkOrigin(const Chunk* chunk) const {
+		return glm::vec3(chunk->coord * CHUNK_SIZE);
+	}
+
+	int loaded() const {
+		return (int)chunks.size();
+	}
+
+	int pendingJobs() const {
+		return inFlight;
+	}
+
+	StreamChunk* find(glm::ivec3 c) const {
+		auto it = chunks.find(key(c));
+		return (it == chunks.end()) ? NULL : it->second;
+	}
+
+	const PredictedPath& predictedPath() const {
+		return path;
+	}
+
+	void update(glm::vec3 pos, glm::vec3 front, float dt) {
+		TRACE_ZONE("StreamingWorld::update");
+		generated = 0;
+		meshed = 0;
+		uploaded = 0;
+		unloaded = 0;
+		if (collect()) {
+			settled = false;
+		}
+
+		trajectory.sample(pos, front, dt);
+		trajectory.predict(prefetchSeconds, path);
+		bool pathMoved = predictAhead();
+		glm::ivec3 c = chunkOf(pos);
+		if (c != centre) {
+			countArrivals(c);
+			centre = c;
+		}
+		if (c != gatheredCentre || pathMoved) {
+			gatheredCentre = c;
+			gatherCandidates();
+			unloadFar();
+			settled = false;
+		}
+		if (!settled) {
+			rankCandidates(pos, front);
+			settled = !launchJobs() && inFlight == 0;
+		}
+		if (jobs->numWorkers() == 1) {
+			// no worker threads, so the main thread takes one job per frame
+			jobs->runOne();
+		}
+		upload(pos, front);
+	}
+
+	void cull(const glm::mat4& viewProj, std::vector<Chunk*>& visible) {
+		visible.clear();
+		boxes.count = 0;
+		drawable.clear();
+		for (auto& entry : chunks) {
+			StreamChunk* sc = entry.second;
+			// the ring at radius + 1 is meshed ahead of time, not drawn
+			if (sc->state == STREAM_READY && sc->chunk->vertexCount > 0 && distance(sc->coord) <= radius) {
+				glm::vec3 o = chunkOrigin(sc->chunk);
+				boxes.add(o, o + (float)CHUNK_SIZE);
+				drawable.push_back(sc->chunk);
+			}
+		}
+		boxes.pad();
+		views.resize(boxes.count);
+		boxes.classify(Frustum(viewProj), 0, boxes.count, views.data());
+		for (size_t i = 0; i < drawable.size(); i++) {
+			if (views[i] != NOLOAD) {
+				visible.push_back(drawable[i]);
+			}
+		}
+	}
+
+	static bool solidAt(uint32_t seed, int x, int y, int z) {
+		/*
+			Two independent noise fields; tunnels run where both are close to
+			their midpoint, which gives long connected worms rather than
+			blobs. Pure function of (seed, x, y, z).
+		*/
+		glm::vec3 p = glm::vec3(x, y, z) / STREAM_NOISE_SCALE;
+		float a = noise(seed, p) - 0.5f;
+		float b = noise(seed ^ 0x9e3779b9u, p + glm::vec3(17.3f, -4.1f, 9.7f)) - 0.5f;
+		return a * a + b * b > STREAM_TUNNEL_WIDTH * STREAM_TUNNEL_WIDTH;
+	}
+
+	static void generate(uint32_t seed, Chunk* chunk) {
+		TRACE_ZONE("generate chunk");
+		glm::ivec3 base = chunk->coord * CHUNK_SIZE;
+		for (int x = 0; x < CHUNK_SIZE; x++) {
+			for (int y = 0; y < CHUNK_SIZE; y++) {
+				for (int z = 0; z < CHUNK_SIZE; z++) {
+					if (solidAt(seed, base.x + x, base.y + y, base.z + z)) {
+						chunk->set(x, y, z, ROCK);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	JobSystem* jobs;
+	std::unordered_map<uint64_t, StreamChunk*> chunks;
+	MPSCQueue<StreamChunk*> results;
+	int inFlight;
+	glm::ivec3 centre;
+	glm::ivec3 gatheredCentre;
+	CameraTrajectory trajectory;
+	PredictedPath path;
+	// chunks on the predicted path other than centre, nearest first
+	std::vector<glm::ivec3> ahead;
+	std::vector<glm::ivec3> aheadScratch;
+	// centre and ahead as of the last gatherCandidates()
+	std::vector<glm::ivec3> sources;
+	std::vector<glm::ivec3> sourcesScratch;
+	// coordinates in generation range, unordered, and each one's index in it
+	std::vector<StreamCandidate> candidates;
+	std::unordered_map<uint64_t, int> candidateIndex;
+	// the candidates with a job left to start, best first
+	std::vector<StreamCandidate*> ranked;
+	// nothing left to start until the camera changes chunk or a job finishes
+	bool settled;
+	std::vector<StreamChunk*> pendingUploads;
+	BoxList boxes;
+	std::vector<Chunk*> drawable;
+	std::vector<inView> views;
+
+	static uint64_t key(glm::ivec3 c) {
+		// 21 bits per axis, two's complement
+		const uint64_t mask = (1ull << 21) - 1;
+		return ((uint64_t)(c.x & mask) << 42) | ((uint64_t)(c.y & mask) << 21) | (uint64_t)(c.z & mask);
+	}
+
+	static uint32_t hash(uint32_t seed, int x, int y, int z) {
+		uint32_t h = seed ^ ((uint32_t)x * 0x8da6b343u) ^ ((uint32_t)y * 0xd8163841u) ^ ((uint32_t)z * 0xcb1ab31fu);
+		h ^= h >> 16;
+		h *= 0x7feb352du;
+		h ^= h >> 15;
+		h *= 0x846ca68bu;
+		h ^= h >> 16;
+		return h;
+	}
+
+	static float noise(uint32_t seed, glm::vec3 p) {
+		// trilinear value noise with smoothstep weights
+		glm::vec3 f = glm::floor(p);
+		glm::ivec3 i(f);
+		glm::vec3 t = p - f;
+		t = t * t * (3.0f - 2.0f * t);
+		float c[2][2][2];
+		for (int dx = 0; dx < 2; dx++) {
+			for (int dy = 0; dy < 2; dy++) {
+				for (int dz = 0; dz < 2; dz++) {
+					c[dx][dy][dz] = (hash(seed, i.x + dx, i.y + dy, i.z + dz) >> 8) * (1.0f / 16777216.0f);
+				}
+			}
+		}
+		float x00 = glm::mix(c[0][0][0], c[1][0][0], t.x);
+		float x10 = glm::mix(c[0][1][0], c[1][1][0], t.x);
+		float x01 = glm::mix(c[0][0][1], c[1][0][1], t.x);
+		float x11 = glm::mix(c[0][1][1], c[1][1][1], t.x);
+		return glm::mix(glm::mix(x00, x10, t.y), glm::mix(x01, x11, t.y), t.z);
+	}
+
+	static float facingDistance(glm::ivec3 c, glm::vec3 pos, glm::vec3 front) {
+		// distance, doubled for chunks straight behind
+		glm::vec3 toChunk = (glm::vec3(c) + 0.5f) * (float)CHUNK_SIZE - pos;
+		float dist = glm::length(toChunk);
+		float facing = (dist > 0.0f) ? glm::dot(toChunk / dist, front) : 1.0f;
+		return dist * (1.5f - 0.5f * facing);
+	}
+
+	float priority(glm::ivec3 c, glm::vec3 pos, glm::vec3 front) const {
+		float best = facingDistance(c, pos, front);
+		for (int k = 0; k < path.count; k++) {
+			best = std::min(best, path.times[k] * path.speed + facingDistance(c, path.points[k], path.dirs[k]));
+		}
+		if (path.count > 0 && distance(c, chunkOf(path.points[path.count - 1])) > radius) {
+			// out of view range by the end of the path
+			best += (float)(radius * CHUNK_SIZE);
+		}
+		return best;
+	}
+
+	static int distance(glm::ivec3 a, glm::ivec3 b) {
+		glm::ivec3 d = glm::abs(a - b);
+		return std::max(d.x, std::max(d.y, d.z));
+	}
+
+	int distance(glm::ivec3 c) const {
+		return distance(c, centre);
+	}
+
+	bool wanted(glm::ivec3 c, int reach) const {
+		// within radius + reach of the camera's chunk or of one on its path
+		if (distance(c) <= radius + reach) {
+			return true;
+		}
+		for (auto& a : ahead) {
+			if (distance(c, a) <= radius + reach) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool predictAhead() {
+		// returns whether the set of chunks on the path changed
+		aheadScratch.clear();
+		glm::ivec3 c = chunkOf(trajectory.position());
+		for (int k = 0; k < path.count; k++) {
+			glm::ivec3 a = chunkOf(path.points[k]);
+			if (a != c && std::find(aheadScratch.begin(), aheadScratch.end(), a) == aheadScratch.end()) {
+				aheadScratch.push_back(a);
+			}
+		}
+		if (aheadScratch == ahead) {
+			return false;
+		}
+		ahead.swap(aheadScratch);
+		return true;
+	}
+
+	void countArrivals(glm::ivec3 next) {
+		// chunks coming into view range as the camera moves from centre to next
+		if (centre == glm::ivec3(INT32_MIN)) {
+			return;
+		}
+		for (int x = -radius; x <= radius; x++) {
+			for (int y = -radius; y <= radius; y++) {
+				for (int z = -radius; z <= radius; z++) {
+					glm::ivec3 c = next + glm::ivec3(x, y, z);
+					if (distance(c) <= radius) {
+						continue;
+					}
+					StreamChunk* sc = find(c);
+					if (sc != NULL && sc->state == STREAM_READY) {
+						prefetch.hits++;
+					}
+					else {
+						prefetch.misses++;
+					}
+					if (sc != NULL) {
+						sc->used = true;
+					}
+				}
+			}
+		}
+	}
+
+	void gatherCandidates() {
+		/*
+			Only the centres that came or went since the last call are
+			visited: a step along the path adds one cube of coordinates and
+			removes another, instead of rebuilding the union of all of them.
+		*/
+		sourcesScratch.clear();
+		sourcesScratch.push_back(centre);
+		for (auto& a : ahead) {
+			if (std::find(sourcesScratch.begin(), sourcesScratch.end(), a) == sourcesScratch.end()) {
+				sourcesScratch.push_back(a);
+			}
+		}
+		for (auto& s : sources) {
+			if (std::find(sourcesScratch.begin(), sourcesScratch.end(), s) == sourcesScratch.end()) {
+				cover(s, -1);
+			}
+		}
+		for (auto& s : sourcesScratch) {
+			if (std::find(sources.begin(), sources.end(), s) == sources.end()) {
+				cover(s, 1);
+			}
+		}
+		sources.swap(sourcesScratch);
+	}
+
+	void cover(glm::ivec3 from, int delta) {
+		// adds or removes one centre's generation range
+		int r = radius + 2;
+		for (int x = -r; x <= r; x++) {
+			for (int y = -r; y <= r; y++) {
+				for (int z = -r; z <= r; z++) {
+					glm::ivec3 c = from + glm::ivec3(x, y, z);
+					uint64_t k = key(c);
+					auto it = candidateIndex.find(k);
+					if (delta > 0 && it == candidateIndex.end()) {
+						candidateIndex[k] = (int)candidates.size();
+						candidates.push_back({ c, 0.0f, 1, find(c) });
+						continue;
+					}
+					int i = it->second;
+					candidates[i].sources += delta;
+					if (candidates[i].sources > 0) {
+						continue;
+					}
+					candidateIndex.erase(it);
+					if (i != (int)candidates.size() - 1) {
+						candidates[i] = candidates.back();
+						candidateIndex[key(candidates[i].coord)] = i;
+					}
+					candidates.pop_back();
+				}
+			}
+		}
+	}
+
+	void rankCandidates(glm::vec3 pos, glm::vec3 front) {
+		// once the view range is loaded only its growing edge has work left, so only that is sorted
+		ranked.clear();
+		for (auto& cand : candidates) {
+			if (cand.sc == NULL || (cand.sc->state == STREAM_GENERATED && wanted(cand.coord, 1))) {
+				cand.priority = priority(cand.coord, pos, front);
+				ranked.push_back(&cand);
+			}
+		}
+		std::sort(ranked.begin(), ranked.end(), [](const StreamCandidate* a, const StreamCandidate* b) { return a->priority < b->priority; });
+	}
+
+	bool neighboursReady(glm::ivec3 c, ChunkNeighbourhood* hood) const {
+		hood->centre = c;
+		for (int dx = -1; dx <= 1; dx++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dz = -1; dz <= 1; dz++) {
+					StreamChunk* n = find(c + glm::ivec3(dx, dy, dz));
+					if (n == NULL || n->state == STREAM_GENERATING) {
+						return false;
+					}
+					hood->chunks[((dx + 1) * 3 + dy + 1) * 3 + dz + 1] = n->chunk;
+				}
+			}
+		}
+		return true;
+	}
+
+	void pinNeighbours(glm::ivec3 c, int delta) {
+		for (int dx = -1; dx <= 1; dx++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dz = -1; dz <= 1; dz++) {
+					find(c + glm::ivec3(dx, dy, dz))->pins += delta;
+				}
+			}
+		}
+	}
+
+	bool launchJobs() {
+		// returns whether anything was started
+		int maxInFlight = jobs->numWorkers() * STREAM_JOBS_PER_WORKER;
+		bool started = false;
+		for (auto cand : ranked) {
+			if (inFlight >= maxInFlight) {
+				break;
+			}
+			StreamChunk* sc = cand->sc;
+			if (sc == NULL) {
+				sc = new StreamChunk();
+				cand->sc = sc;
+				sc->coord = cand->coord;
+				sc->chunk = NULL;
+				sc->state = STREAM_GENERATING;
+				sc->pins = 0;
+				sc->priority = cand->priority;
+				sc->prefetched = distance(sc->coord) > radius + 2;
+				sc->used = distance(sc->coord) <= radius;
+				if (sc->prefetched) {
+					prefetch.prefetched++;
+				}
+				chunks[key(sc->coord)] = sc;
+				inFlight++;
+				uint32_t s = seed;
+				MPSCQueue<StreamChunk*>* out = &results;
+				jobs->launch([sc, s, out]() {
+					Chunk* chunk = new Chunk(sc->coord);
+					generate(s, chunk);
+					sc->chunk = chunk;
+					out->push(sc);
+				});
+				started = true;
+				continue;
+			}
+			ChunkNeighbourhood hood;
+			if (sc->state != STREAM_GENERATED || !wanted(sc->coord, 1) || !neighboursReady(sc->coord, &hood)) {
+				continue;
+			}
+			sc->state = STREAM_MESHING;
+			sc->priority = cand->priority;
+			pinNeighbours(sc->coord, 1);
+			inFlight++;
+			meshMode m = meshing;
+			MPSCQueue<StreamChunk*>* out = &results;
+			jobs->launch([sc, hood, m, out]() {
+				static thread_local Mesher mesher;
+				mesher.mode = m;
+				mesher.mesh(&hood, sc->chunk, sc->mesh);
+				out->push(sc);
+			});
+			started = true;
+		}
+		return started;
+	}
+
+	bool collect() {
+		// returns whether any job finished
+		StreamChunk* sc;
+		bool any = false;
+		while (results.pop(sc)) {
+			any = true;
+			inFlight--;
+			if (sc->state == STREAM_GENERATING) {
+				sc->state = STREAM_GENERATED;
+				MemoryTracker::get().add(MEM_VOXELS, sizeof(Chunk));
+				generated++;
+			}
+			else {
+				sc->state = STREAM_MESHED;
+				pinNeighbours(sc->coord, -1);
+				MemoryTracker::get().add(MEM_MESHES, sc->mesh.capacity() * sizeof(packedVertex));
+				pendingUploads.push_back(sc);
+				meshed++;
+			}
+		}
+		return any;
+	}
+
+	void upload(glm::vec3 pos, glm::vec3 front) {
+		if (pendingUploads.empty()) {
+			return;
+		}
+		for (auto sc : pendingUploads) {
+			sc->priority = priority(sc->coord, pos, front);
+		}
+		std::sort(pendingUploads.begin(), pendingUploads.end(), [](const StreamChunk* a, const StreamChunk* b) { return a->priority < b->priority; });
+		int n = std::min((int)pendingUploads.size(), uploadsPerFrame);
+		for (int i = 0; i < n; i++) {
+			StreamChunk* sc = pendingUploads[i];
+			if (uploadMesh != NULL) {
+				uploadMesh(sc->chunk, sc->mesh);
+			}
+			else {
+				sc->chunk->vertexCount = (int)sc->mesh.size();
+			}
+			releaseCpuMesh(sc);
+			sc->state = STREAM_READY;
+			uploaded++;
+		}
+		pendingUploads.erase(pendingUploads.begin(), pendingUploads.begin() + n);
+	}
+
+	void releaseCpuMesh(StreamChunk* sc) {
+		MemoryTracker::get().release(MEM_MESHES, sc->mesh.capacity() * sizeof(packedVertex));
+		std::vector<packedVertex>().swap(sc->mesh);
+	}
+
+	void unloadFar() {
+		for (auto it = chunks.begin(); it != chunks.end();) {
+			StreamChunk* sc = it->second;
+			bool busy = sc->state == STREAM_GENERATING || sc->state == STREAM_MESHING || sc->pins > 0;
+			if (busy || wanted(sc->coord, 3)) {
+				++it;
+				continue;
+			}
+			if (sc->prefetched && !sc->used) {
+				prefetch.wasted++;
+			}
+			if (sc->state == STREAM_MESHED) {
+				pendingUploads.erase(std::find(pendingUploads.begin(), pendingUploads.end(), sc));
+			}
+			drop(sc);
+			it = chunks.erase(it);
+			unloaded++;
+		}
+	}
+
+	void drop(StreamChunk* sc) {
+		if (sc->state == STREAM_READY && releaseMesh != NULL) {
+			releaseMesh(sc->chunk);
+		}
+		if (sc->state == STREAM_MESHED) {
+			releaseCpuMesh(sc);
+		}
+		if (sc->chunk != NULL) {
+			MemoryTracker::get().release(MEM_VOXELS, sizeof(Chunk));
+			delete(sc->chunk);
+		}
+		delete(sc);
+	}
+};
+
+#endif
@@ -0,0 +1,96 @@
+/*
+	Streaming benchmark
+	---------------------
+	g++ -O2 -std=c++17 -Iinclude src/stream_bench.cpp -lpthread -o cave_stream_bench
+	./cave_stream_bench [--radius N] [--threads N] [--prefetch S] [--speed V] [--turn D] [--seconds S] [--seed N]
+	Drives a StreamingWorld the way the simulation thread does: one
+	update() per frame, paced at STREAM_BENCH_HZ in real time, so the
+	workers get as long to generate and mesh as they would in the game.
+	The world first loads around the start point until nothing is left
+	to do. Then the camera moves at --speed voxels per second (default
+	MAXSPEED) for --seconds, turning --turn degrees per second (0 is a
+	straight run). Prints the prefetch hit rate and what update() itself
+	cost per frame.
+	--threads 0 (default) uses every core, like main.cpp; with one
+	worker the simulation thread runs one job per frame itself.
+	---------------------
+*/
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include "camera.h"
+#include "jobs.h"
+#include "memory.h"
+#include "stream.h"
+#include "test_cave.h"
+
+const int STREAM_BENCH_HZ = 60;
+// the initial load gives up after this many seconds
+const float STREAM_BENCH_LOAD_SECONDS = 60.0f;
+
+int main(int argc, char** argv) {
+    int radius = std::max(1, (int)intOption(argc, argv, "--radius", 3));
+    int threads = (int)intOption(argc, argv, "--threads", 0);
+    float prefetchSeconds = floatOption(argc, argv, "--prefetch", STREAM_PREFETCH_SECONDS);
+    float speed = floatOption(argc, argv, "--speed", MAXSPEED);
+    float turn = floatOption(argc, argv, "--turn", 0.0f);
+    float seconds = floatOption(argc, argv, "--seconds", 20.0f);
+    uint32_t seed = (uint32_t)intOption(argc, argv, "--seed", 1);
+    MemoryTracker::get().quiet = true;
+    JobSystem* jobs = new JobSystem(threads);
+    StreamingWorld* world = new StreamingWorld(jobs, radius, seed);
+    world->prefetchSeconds = prefetchSeconds;
+
+    const float dt = 1.0f / STREAM_BENCH_HZ;
+    const auto frameTime = std::chrono::microseconds(1000000 / STREAM_BENCH_HZ);
+    glm::vec3 pos(0.0f);
+    float yaw = YAW;
+    glm::vec3 front(std::cos(glm::radians(yaw)), 0.0f, std::sin(glm::radians(yaw)));
+
+    auto next = std::chrono::steady_clock::now();
+    int loadFrames = 0;
+    do {
+        world->update(pos, front, dt);
+        loadFrames++;
+        next += frameTime;
+        std::this_thread::sleep_until(next);
+    } while ((world->pendingJobs() > 0 || loadFrames < STREAM_BENCH_HZ) && loadFrames < STREAM_BENCH_LOAD_SECONDS * STREAM_BENCH_HZ);
+    std::cout << "radius " << radius << ", " << jobs->numWorkers() << " workers, prefetch " << prefetchSeconds << " s, "
+        << speed << " voxels/s, turning " << turn << " deg/s" << std::endl;
+    std::cout << "initial load: " << world->loaded() << " chunks in " << loadFrames << " frames" << std::endl;
+
+    int frames = (int)(seconds * STREAM_BENCH_HZ);
+    double totalMs = 0.0;
+    double worstMs = 0.0;
+    long long generated = 0;
+    long long meshed = 0;
+    long long unloaded = 0;
+    next = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        yaw += turn * dt;
+        front = glm::vec3(std::cos(glm::radians(yaw)), 0.0f, std::sin(glm::radians(yaw)));
+        pos += front * speed * dt;
+        auto start = std::chrono::steady_clock::now();
+        world->update(pos, front, dt);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        totalMs += ms;
+        worstMs = std::max(worstMs, ms);
+        generated += world->generated;
+        meshed += world->meshed;
+        unloaded += world->unloaded;
+        next += frameTime;
+        std::this_thread::sleep_until(next);
+    }
+    std::cout << "moving: " << frames << " frames, " << generated << " generated, " << meshed << " meshed, "
+        << unloaded << " unloaded, " << world->loaded() << " loaded at the end" << std::endl;
+    std::cout << std::fixed << std::setprecision(3) << "update(): " << totalMs / std::max(1, frames) << " ms average, "
+        << worstMs << " ms worst" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    world->prefetch.report(std::cout);
+
+    delete(world);
+    delete(jobs);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef TEST_CAVE_H
+#define TEST_CAVE_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+#include "chunk.h"
+#include "lsystem.h"
+
+/*
+	Fixtures for the headless entry points (bench.cpp and the *_check.cpp
+	files): a deterministic cave, camera spots inside it, and their
+	command-line options.
+*/
+
+// the same blobs of air every run, so every build measures and checks the same cave
+const uint32_t TEST_CAVE_SEED = 1234;
+const uint32_t TEST_SPOT_SEED = 99;
+
+inline void carveTestCave(LSystem& lsystem, uint32_t seed = TEST_CAVE_SEED) {
+	// spheres of air in lsystem's matrix, which setupMatrix() left solid
+	int n = lsystem.numCubes;
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<int> coord(0, n - 1);
+	std::uniform_int_distribution<int> radius(2, std::max(3, n / 12));
+	int blobs = std::max(8, n / 2);
+	for (int b = 0; b < blobs; b++) {
+		int cx = coord(rng), cy = coord(rng), cz = coord(rng), r = radius(rng);
+		for (int x = std::max(0, cx - r); x < std::min(n, cx + r + 1); x++) {
+			for (int y = std::max(0, cy - r); y < std::min(n, cy + r + 1); y++) {
+				for (int z = std::max(0, cz - r); z < std::min(n, cz + r + 1); z++) {
+					int dx = x - cx, dy = y - cy, dz = z - cz;
+					if (dx * dx + dy * dy + dz * dz <= r * r) {
+						lsystem.matrix[x][y][z] = 2;
+					}
+				}
+			}
+		}
+	}
+}
+
+inline std::vector<glm::vec3> testCameraSpots(const VoxelGrid* grid, int count, uint32_t seed = TEST_SPOT_SEED) {
+	// centres of air voxels, for a camera that visits a new spot every frame
+	std::vector<glm::vec3> spots;
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<int> coord(0, grid->size - 1);
+	while ((int)spots.size() < count) {
+		glm::ivec3 v(coord(rng), coord(rng), coord(rng));
+		if (grid->getVoxel(v.x, v.y, v.z) == AIR) {
+			spots.push_back(grid->origin + glm::vec3(v) + 0.5f);
+		}
+	}
+	return spots;
+}
+
+inline const char* optionValue(int argc, char** argv, const char* name) {
+	// the argument after the last "name", or NULL
+	const char* value = NULL;
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], name) == 0) {
+			value = argv[++i];
+		}
+	}
+	return value;
+}
+
+inline long long intOption(int argc, char** argv, const char* name, long long fallback) {
+	const char* value = optionValue(argc, argv, name);
+	return (value != NULL) ? atoll(value) : fallback;
+}
+
+inline float floatOption(int argc, char** argv, const char* name, float fallback) {
+	const char* value = optionValue(argc, argv, name);
+	return (value != NULL) ? (float)atof(value) : fallback;
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// build with TRACE_ENABLED=0 to compile every zone out
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// events kept per thread; older ones are overwritten
+const int TRACE_CAPACITY = 1 << 16;
+
+class TraceEvent {
+public:
+	// must outlive the trace, in practice a string literal
+	const char* name;
+	uint64_t start;
+	uint64_t duration;
+};
+
+class TraceBuffer {
+public:
+	TraceEvent events[TRACE_CAPACITY];
+	// only the owning thread writes, the exporter reads up to this
+	std::atomic<uint64_t> written;
+	int tid;
+	std::string threadName;
+
+	TraceBuffer() : written(0) {
+		tid = 0;
+	}
+};
+
+class Tracer {
+public:
+	/*
+		Scoped-zone tracer
+		---------------------
+		Every thread records into its own ring buffer, so recording takes
+		no locks: the thread writes the event, then publishes it by bumping
+		its write count. The lock is only taken once per thread, when its
+		buffer is created. Timestamps are steady-clock nanoseconds since the
+		tracer started. When tracing is off a zone costs a relaxed atomic
+		load and a branch; with TRACE_ENABLED=0 nothing is left at all.
+		writeJson() produces Chrome trace_event JSON (chrome://tracing,
+		Perfetto), one complete ("X") event per zone.
+		---------------------
+	*/
+	std::atomic<bool> enabled;
+
+	static Tracer& get() {
+		static Tracer tracer;
+		return tracer;
+	}
+
+	~Tracer() {
+		for (auto b : buffers) {
+			delete(b);
+		}
+	}
+
+	uint64_t now() const {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	void record(const char* name, uint64_t start, uint64_t end) {
+		TraceBuffer* b = buffer();
+		uint64_t i = b->written.load(std::memory_order_relaxed);
+		TraceEvent& e = b->events[i % TRACE_CAPACITY];
+		e.name = name;
+		e.start = start;
+		e.duration = end - start;
+		b->written.store(i + 1, std::memory_order_release);
+	}
+
+	static void nameThread(const std::string& name) {
+		// kept aside so threads don't get a buffer before anything is traced
+		threadName() = name;
+	}
+
+	bool writeJson(const std::string& path) {
+		std::ofstream file(path);
+		if (!file.is_open()) {
+			std::cerr << "Failed to open " << path << std::endl;
+			return false;
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		bool first = true;
+		size_t count = 0;
+		for (auto b : buffers) {
+			file << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"args\":{\"name\":\"" << b->threadName << "\"}}";
+			first = false;
+			uint64_t end = b->written.load(std::memory_order_acquire);
+			uint64_t begin = (end > (uint64_t)TRACE_CAPACITY) ? end - TRACE_CAPACITY : 0;
+			for (uint64_t i = begin; i < end; i++) {
+				const TraceEvent& e = b->events[i % TRACE_CAPACITY];
+				// microseconds, with the nanoseconds kept as decimals
+				file << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"cave\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+					<< ",\"ts\":" << e.start / 1000 << "." << pad3(e.start % 1000)
+					<< ",\"dur\":" << e.duration / 1000 << "." << pad3(e.duration % 1000) << "}";
+				count++;
+			}
+		}
+		file << "\n]}" << std::endl;
+		std::cout << "Wrote " << count << " trace events to " << path << std::endl;
+		return (bool)file;
+	}
+
+private:
+	std::chrono::steady_clock::time_point epoch;
+	std::mutex lock;
+	std::vector<TraceBuffer*> buffers;
+
+	Tracer() : enabled(false) {
+		epoch = std::chrono::steady_clock::now();
+	}
+
+	static std::string& threadName() {
+		static thread_local std::string name;
+		return name;
+	}
+
+	static std::string pad3(uint64_t v) {
+		std::string s = std::to_string(v);
+		return std::string(3 - s.size(), '0') + s;
+	}
+
+	TraceBuffer* buffer() {
+		static thread_local TraceBuffer* mine = NULL;
+		if (mine == NULL) {
+			mine = new TraceBuffer();
+			std::lock_guard<std::mutex> guard(lock);
+			mine->tid = (int)buffers.size();
+			mine->threadName = threadName().empty() ? "thread " + std::to_string(mine->tid) : threadName();
+			buffers.push_back(mine);
+		}
+		return mine;
+	}
+};
+
+class TraceZone {
+public:
+	TraceZone(const char* n) {
+		name = NULL;
+		start = 0;
+		if (Tracer::get().enabled.load(std::memory_order_relaxed)) {
+			name = n;
+			start = Tracer::get().now();
+		}
+	}
+
+	~TraceZone() {
+		if (name != NULL) {
+			Tracer::get().record(name, start, Tracer::get().now());
+		}
+	}
+
+private:
+	const char* name;
+	uint64_t start;
+};
+
+#if TRACE_ENABLED
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// times the rest of the enclosing scope
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_THREAD(name) Tracer::nameThread(name)
+#else
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_THREAD(name) ((void)0)
+#endif
+
+#endif